@@ -0,0 +1,280 @@
+/*
+** $Id: ccode.c $
+** write chunks as C code
+** See Copyright Notice in lua.h
+*/
+
+#include <stdio.h>
+
+#define luac_c
+#define LUA_CORE
+
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lundump.h"
+
+#define CodeChunk	luaU_ccode
+
+/*
+** The chunk is written as a C module: its precompiled bytecodes and one
+** C function per prototype, in preorder. Each C function runs the
+** instructions of its prototype from a given pc up to the next call or
+** return, and returns the index of that instruction to the interpreter,
+** which does the call and enters the C function again when the call
+** returns. Moves, constants, tests, jumps, numeric loops and number
+** arithmetic are written inline; every other instruction is executed by
+** lua_execop, exactly as the interpreter would.
+*/
+
+typedef struct {
+ FILE* D;
+ int n;			/* bytes written so far */
+} CState;
+
+static int writer(lua_State* L, const void* p, size_t size, void* u)
+{
+ CState* S=(CState*)u;
+ const unsigned char* b=(const unsigned char*)p;
+ size_t i;
+ UNUSED(L);
+ for (i=0; i<size; i++,S->n++)
+  fprintf(S->D,"%s%u,",(S->n%20==0) ? "\n " : "",b[i]);
+ return ferror(S->D);
+}
+
+#define isinline(o)	((o)==OP_MOVE || (o)==OP_LOADK || (o)==OP_LOADBOOL || \
+			 (o)==OP_LOADNIL || (o)==OP_GETUPVAL || (o)==OP_NOT || \
+			 (o)==OP_TEST || (o)==OP_TESTSET || (o)==OP_FORLOOP || \
+			 ((o)>=OP_ADD && (o)<=OP_DIV))
+
+/* mark jump targets and reentry points; see whether `base' and `k' are used */
+static void MarkCode(const Proto* f, lu_byte* mark, int* usebase, int* usek)
+{
+ const Instruction* code=f->code;
+ int pc,n=f->sizecode;
+ *usebase=*usek=0;
+ mark[0]=1;
+ for (pc=0; pc<n; pc++)
+ {
+  Instruction i=code[pc];
+  OpCode o=luaP_opbase[GET_OPCODE(i)];
+  int b=GETARG_B(i);
+  int c=GETARG_C(i);
+  int sbx=GETARG_sBx(i);
+  if (isinline(o)) *usebase=1;
+  if (o==OP_LOADK || (o>=OP_ADD && o<=OP_DIV && (ISK(b) || ISK(c)))) *usek=1;
+  switch (o)
+  {
+   case OP_CALL:
+    mark[pc+1]=2;			/* reentered when the call returns */
+    break;
+   case OP_LOADBOOL:
+    if (c) mark[pc+2]=1;
+    break;
+   case OP_EQ:
+   case OP_LT:
+   case OP_LE:
+   case OP_TEST:
+   case OP_TESTSET:
+   case OP_TFORLOOP:
+    mark[pc+2]=1;
+    break;
+   case OP_JMP:
+   case OP_FORPREP:
+   case OP_FORLOOP:
+    mark[pc+1+sbx]=1;
+    break;
+   case OP_CLOSURE:
+    pc+=f->p[GETARG_Bx(i)]->nups;	/* skip pseudo-instructions */
+    break;
+   case OP_SETLIST:
+    if (c==0) pc++;			/* skip extra argument */
+    break;
+   default:
+    break;
+  }
+ }
+}
+
+static void CodeRK(FILE* D, int x)
+{
+ if (ISK(x)) fprintf(D,"K(%d)",INDEXK(x)); else fprintf(D,"R(%d)",x);
+}
+
+static void CodeJump(FILE* D, int pc, int to)
+{
+ if (to<=pc) fprintf(D,"  if (HOOKED) return %d;\n",to);
+ fprintf(D,"  goto L%d;\n",to);
+}
+
+static void CodeArith(FILE* D, const Proto* f, int pc, int usebase)
+{
+ static const char* const ops[]={ "add","sub","mul","div" };
+ Instruction i=f->code[pc];
+ OpCode o=luaP_opbase[GET_OPCODE(i)];
+ int b=GETARG_B(i);
+ int c=GETARG_C(i);
+ int nb=ISK(b) && ttisnumber(&f->k[INDEXK(b)]);
+ int nc=ISK(c) && ttisnumber(&f->k[INDEXK(c)]);
+ fprintf(D,"  { TValue *rb="); CodeRK(D,b);
+ fprintf(D,", *rc="); CodeRK(D,c);
+ fprintf(D,";\n    if (");
+ if (!nb) fprintf(D,"ttisnumber(rb)");
+ if (!nb && !nc) fprintf(D," && ");
+ if (!nc) fprintf(D,"ttisnumber(rc)");
+ if (nb && nc) fprintf(D,"1");
+ fprintf(D,") { setnvalue(R(%d),luai_num%s(nvalue(rb),nvalue(rc))); }\n",
+	GETARG_A(i),ops[o-OP_ADD]);
+ fprintf(D,"    else %s%d); }\n",usebase ? "EXEC(" : "lua_execop(L,",pc);
+}
+
+static void CodeOp(FILE* D, const Proto* f, int pc, int usebase)
+{
+ Instruction i=f->code[pc];
+ OpCode o=luaP_opbase[GET_OPCODE(i)];
+ int a=GETARG_A(i);
+ int b=GETARG_B(i);
+ int c=GETARG_C(i);
+ int bx=GETARG_Bx(i);
+ int sbx=GETARG_sBx(i);
+ switch (o)
+ {
+  case OP_MOVE:
+   fprintf(D,"  setobjs2s(L,R(%d),R(%d));\n",a,b);
+   break;
+  case OP_LOADK:
+   fprintf(D,"  setobj2s(L,R(%d),K(%d));\n",a,bx);
+   break;
+  case OP_LOADBOOL:
+   fprintf(D,"  setbvalue(R(%d),%d);\n",a,b!=0);
+   if (c) fprintf(D,"  goto L%d;\n",pc+2);
+   break;
+  case OP_LOADNIL:
+   for (; a<=b; a++) fprintf(D,"  setnilvalue(R(%d));\n",a);
+   break;
+  case OP_GETUPVAL:
+   fprintf(D,"  setobj2s(L,R(%d),curr_func(L)->l.upvals[%d]->v);\n",a,b);
+   break;
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+   CodeArith(D,f,pc,usebase);
+   break;
+  case OP_NOT:
+   fprintf(D,"  { int res=l_isfalse(R(%d)); setbvalue(R(%d),res); }\n",b,a);
+   break;
+  case OP_JMP:
+   CodeJump(D,pc,pc+1+sbx);
+   break;
+  case OP_TEST:
+   fprintf(D,"  if (%sl_isfalse(R(%d))) goto L%d;\n",c ? "" : "!",a,pc+2);
+   break;
+  case OP_TESTSET:
+   fprintf(D,"  if (%sl_isfalse(R(%d))) goto L%d;\n",c ? "" : "!",b,pc+2);
+   fprintf(D,"  setobjs2s(L,R(%d),R(%d));\n",a,b);
+   break;
+  case OP_EQ:
+  case OP_LT:
+  case OP_LE:
+  case OP_TFORLOOP:
+   fprintf(D,"  if (!%s%d)) goto L%d;\n",usebase ? "COND(" : "lua_execop(L,",pc,pc+2);
+   break;
+  case OP_FORPREP:
+   fprintf(D,"  %s%d);\n",usebase ? "EXEC(" : "lua_execop(L,",pc);
+   fprintf(D,"  goto L%d;\n",pc+1+sbx);
+   break;
+  case OP_FORLOOP:
+   fprintf(D,"  if (ttisint(R(%d))) { lua_Integer step=ivalue(R(%d));\n",a,a+2);
+   fprintf(D,"    lua_Integer idx=ivalue(R(%d))+step;\n",a);
+   fprintf(D,"    lua_Integer limit=ivalue(R(%d));\n",a+1);
+   fprintf(D,"    if (0<step ? idx<=limit : limit<=idx) {\n");
+   fprintf(D,"      setivalue(R(%d),idx); setivalue(R(%d),idx);\n",a,a+3);
+   fprintf(D,"    "); CodeJump(D,pc,pc+1+sbx);
+   fprintf(D,"    } }\n");
+   fprintf(D,"  else { lua_Number step=nvalue(R(%d));\n",a+2);
+   fprintf(D,"    lua_Number idx=luai_numadd(nvalue(R(%d)),step);\n",a);
+   fprintf(D,"    lua_Number limit=nvalue(R(%d));\n",a+1);
+   fprintf(D,"    if (luai_numlt(0,step) ? luai_numle(idx,limit) : luai_numle(limit,idx)) {\n");
+   fprintf(D,"      setnvalue(R(%d),idx); setnvalue(R(%d),idx);\n",a,a+3);
+   fprintf(D,"    "); CodeJump(D,pc,pc+1+sbx);
+   fprintf(D,"    } }\n");
+   break;
+  case OP_CALL:
+  case OP_TAILCALL:
+  case OP_RETURN:
+   fprintf(D,"  return %d;\n",pc);
+   break;
+  default:
+   fprintf(D,"  %s%d);\n",usebase ? "EXEC(" : "lua_execop(L,",pc);
+   break;
+ }
+}
+
+static int CodeFunction(lua_State* L, FILE* D, const Proto* f, int n)
+{
+ const Instruction* code=f->code;
+ int pc,i,m=n+1;
+ int usebase,usek;
+ lu_byte* mark=luaM_newvector(L,f->sizecode+1,lu_byte);
+ for (pc=0; pc<=f->sizecode; pc++) mark[pc]=0;
+ MarkCode(f,mark,&usebase,&usek);
+ fprintf(D,"\nstatic int f%d (lua_State *L, int pc) {\n",n);
+ if (usebase) fprintf(D,"  StkId base=L->base;\n");
+ if (usek) fprintf(D,"  TValue *k=curr_func(L)->l.p->k;\n");
+ fprintf(D,"  switch (pc) {\n");
+ fprintf(D,"    case 0: goto L0;\n");
+ for (pc=1; pc<f->sizecode; pc++)
+  if (mark[pc]==2) fprintf(D,"    case %d: goto L%d;\n",pc,pc);
+ fprintf(D,"    default: return pc;\n  }\n");
+ for (pc=0; pc<f->sizecode; pc++)
+ {
+  OpCode o=luaP_opbase[GET_OPCODE(code[pc])];
+  if (mark[pc]) fprintf(D," L%d:",pc);
+  fprintf(D,"  /* %s */\n",luaP_opnames[o]);
+  CodeOp(D,f,pc,usebase);
+  if (o==OP_CLOSURE)
+   pc+=f->p[GETARG_Bx(code[pc])]->nups;
+  else if (o==OP_SETLIST && GETARG_C(code[pc])==0)
+   pc++;
+ }
+ fprintf(D,"}\n");
+ luaM_freearray(L,mark,f->sizecode+1,lu_byte);
+ for (i=0; i<f->sizep; i++) m=CodeFunction(L,D,f->p[i],m);
+ return m;
+}
+
+void CodeChunk(lua_State* L, const Proto* f, FILE* D, const char* name, int strip)
+{
+ CState S;
+ int i,n;
+ fprintf(D,"/* generated by luac -C; do not edit */\n\n");
+ fprintf(D,"#define LUA_CORE\n\n");
+ fprintf(D,"#include \"lua.h\"\n#include \"lauxlib.h\"\n\n");
+ fprintf(D,"#include \"ljit.h\"\n#include \"lobject.h\"\n#include \"lstate.h\"\n\n");
+ fprintf(D,"#define R(x)\t\t(base+(x))\n");
+ fprintf(D,"#define K(x)\t\t(k+(x))\n");
+ fprintf(D,"#define EXEC(pc)\t(lua_execop(L,pc), base=L->base)\n");
+ fprintf(D,"#define COND(pc)\t(lua_execop(L,pc) ? (base=L->base, 1) : (base=L->base, 0))\n");
+ fprintf(D,"#define HOOKED\t\t(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))\n");
+ n=CodeFunction(L,D,f,0);
+ fprintf(D,"\nstatic const lua_Native natives[]={");
+ for (i=0; i<n; i++) fprintf(D,"%s f%d",(i>0) ? "," : "",i);
+ fprintf(D," };\n\nstatic const unsigned char chunk[]={");
+ S.D=D;
+ S.n=0;
+ lua_lock(L);
+ luaU_dump(L,f,writer,&S,strip);
+ lua_unlock(L);
+ fprintf(D,"\n};\n\n");
+ fprintf(D,"int luaopen_%s (lua_State *L) {\n",name);
+ fprintf(D,"  if (luaL_loadbuffer(L,(const char *)chunk,sizeof(chunk),\"=%s\")!=0)\n",name);
+ fprintf(D,"    lua_error(L);\n");
+ fprintf(D,"  switch (lua_setnative(L,-1,natives,%d,LUAI_NATIVECONF)) {\n",n);
+ fprintf(D,"    case -1: return luaL_error(L,LUA_QS \" was compiled for another Lua configuration\",\"%s\");\n",name);
+ fprintf(D,"    case 0: return luaL_error(L,\"bad compiled code in \" LUA_QS,\"%s\");\n  }\n",name);
+ fprintf(D,"  lua_pushvalue(L,1);\n");
+ fprintf(D,"  lua_call(L,1,1);\n");
+ fprintf(D,"  return 1;\n}\n");
+}
@@ -14,12 +14,14 @@
 #define LUA_CORE
 
 #include "lua.h"
+#include "lualib.h"
 
 #include "lapi.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -477,7 +479,9 @@ LUA_API lua_Number lua_tonumber (lua_State *L, int idx) {
 LUA_API lua_Integer lua_tointeger (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
-  if (tonumber(o, &n)) {
+  if (ttisint(o))
+    return ivalue(o);
+  else if (tonumber(o, &n)) {
     lua_Integer res;
     lua_Number num = nvalue(o);
     lua_number2integer(res, num);
@@ -668,7 +672,7 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 */
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setnvalue(L->top, cast_num(n));
+  setinteger(L->top, n);
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -886,10 +890,11 @@ LUA_API void lua_getfield (lua_State *L, int idx, const char *k) {
 */
 LUA_API void lua_rawget (lua_State *L, int idx) {
   StkId t;
+  TValue tmp;
   lua_lock(L);
   t = index2adr(L, idx);
   api_check(L, ttistable(t));
-  setobj2s(L, L->top - 1, luaH_get(hvalue(t), L->top - 1));
+  setobj2s(L, L->top - 1, luaH_get(hvalue(t), L->top - 1, &tmp));
   lua_unlock(L);
 }
 
@@ -905,12 +910,47 @@ LUA_API void lua_rawgeti (lua_State *L, int idx, int n) {
   lua_lock(L);
   o = index2adr(L, idx);
   api_check(L, ttistable(o));
-  setobj2s(L, L->top, luaH_getnum(hvalue(o), n));
+  setobj2s(L, L->top, luaH_getnum(hvalue(o), n, L->top));
   api_incr_top(L);
   lua_unlock(L);
 }
 
 
+/*
+** Pushes onto the stack the values t[i], t[i+1], ..., t[j], where t is the
+** value at the given valid index, with raw accesses. Pushes nothing if i > j.
+** The caller must ensure that the stack has room for them (see
+** lua_checkstack).
+**
+** [-0, +(j-i+1), -]
+*/
+LUA_API void lua_rawunpack (lua_State *L, int idx, int i, int j) {
+  StkId o;
+  Table *h;
+  int n, k;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_check(L, ttistable(o));
+  h = hvalue(o);
+  if (i <= j) {
+    n = j - i + 1;
+    api_check(L, n > 0 && n <= L->ci->top - L->top);
+    if (!ispacked(h) && i >= 1 && j <= h->sizearray)  /* in array part? */
+      memcpy(L->top, &h->array[i-1], cast(size_t, n) * sizeof(TValue));
+    else {
+      for (k = 0; k < n; k++) {
+        if (cast(unsigned int, i+k-1) < cast(unsigned int, h->sizearray))
+          getarray(L, h, i+k-1, L->top+k)
+        else
+          setobj2s(L, L->top+k, luaH_getnum(h, i+k, L->top+k));
+      }
+    }
+    L->top += n;
+  }
+  lua_unlock(L);
+}
+
+
 /*
 ** Creates a new empty table and pushes it onto the stack. The new table has
 ** space pre-allocated for narr array elements and nrec non-array elements. This
@@ -928,6 +968,25 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
 }
 
 
+/*
+** Makes room in the table at the given valid index for at least narr array
+** elements and for nrec non-array elements besides the ones it already has,
+** so that storing them does not need to resize the table again. The table
+** never shrinks.
+**
+** [-0, +0, m]
+*/
+LUA_API void lua_reservetable (lua_State *L, int idx, int narr, int nrec) {
+  StkId t;
+  lua_lock(L);
+  api_check(L, narr >= 0 && nrec >= 0);
+  t = index2adr(L, idx);
+  api_check(L, ttistable(t));
+  luaH_reserve(L, hvalue(t), narr, nrec);
+  lua_unlock(L);
+}
+
+
 /*
 ** Pushes onto the stack the metatable of the value at the given acceptable
 ** index. If the index is not valid, or if the value does not have a metatable,
@@ -1055,8 +1114,7 @@ LUA_API void lua_rawset (lua_State *L, int idx) {
   api_checknelems(L, 2);
   t = index2adr(L, idx);
   api_check(L, ttistable(t));
-  setobj2t(L, luaH_set(L, hvalue(t), L->top-2), L->top-1);
-  luaC_barriert(L, hvalue(t), L->top-1);
+  luaH_setobj(L, hvalue(t), L->top-2, L->top-1);
   L->top -= 2;
   lua_unlock(L);
 }
@@ -1073,12 +1131,69 @@ LUA_API void lua_rawset (lua_State *L, int idx) {
 */
 LUA_API void lua_rawseti (lua_State *L, int idx, int n) {
   StkId o;
+  Table *h;
   lua_lock(L);
   api_checknelems(L, 1);
   o = index2adr(L, idx);
   api_check(L, ttistable(o));
-  setobj2t(L, luaH_setnum(L, hvalue(o), n), L->top-1);
-  luaC_barriert(L, hvalue(o), L->top-1);
+  h = hvalue(o);
+  if (cast(unsigned int, n-1) < cast(unsigned int, h->sizearray))
+    setarray(L, h, n-1, L->top-1)  /* (a packed array part stays packed) */
+  else {
+    TValue k;
+    setinteger(&k, n);
+    luaH_setobj(L, h, &k, L->top-1);
+  }
+  L->top--;
+  lua_unlock(L);
+}
+
+
+/*
+** Does the equivalent of t2[t], t2[t+1], ..., t2[t+e-f] = t1[f], t1[f+1],
+** ..., t1[e], where t1 and t2 are the tables at the given valid indices
+** `from' and `to', which may be the same table (and then the ranges may
+** overlap). The assignments are raw; the ones within the array parts of
+** both tables are done as a block. Does nothing if f > e. Neither e-f nor
+** t+(e-f) may overflow.
+**
+** [-0, +0, m]
+*/
+LUA_API void lua_rawmove (lua_State *L, int from, int f, int e, int t,
+                                        int to) {
+  StkId t1, t2;
+  lua_lock(L);
+  t1 = index2adr(L, from);
+  t2 = index2adr(L, to);
+  api_check(L, ttistable(t1) && ttistable(t2));
+  if (f <= e) {
+    api_check(L, f > 0 || e < INT_MAX + f);
+    api_check(L, t <= INT_MAX - (e - f));
+    luaH_move(L, hvalue(t1), f, e, t, hvalue(t2));
+  }
+  lua_unlock(L);
+}
+
+
+/*
+** Sorts t[1], ..., t[n] in place, where t is the table at the given valid
+** index, and pops the order function from the top of the stack: a function
+** f such that f(a, b) is true when a must come before b, or nil to use the
+** order of lua_lessthan. Accesses to t are raw. If stable is nonzero, equal
+** elements keep their relative order (and if f raises an error, the table
+** may be left with some elements missing and others repeated).
+**
+** [-1, +0, e]
+*/
+LUA_API void lua_sort (lua_State *L, int idx, int n, int stable) {
+  StkId t;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  t = index2adr(L, idx);
+  api_check(L, ttistable(t));
+  api_check(L, ttisnil(L->top - 1) || ttisfunction(L->top - 1));
+  luaC_checkGC(L);
+  luaH_sort(L, hvalue(t), n, stable);
   L->top--;
   lua_unlock(L);
 }
@@ -1105,6 +1220,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case LUA_TTABLE: {
+      luaT_mcwrite(L, hvalue(obj));
       hvalue(obj)->metatable = mt;
       if (mt)
         luaC_objbarriert(L, hvalue(obj), mt);
@@ -1520,6 +1636,127 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+/*
+** Trace compiler function
+**
+** Controls the compilation of hot loops and functions to machine code,
+** according to the value of the parameter what:
+**
+** (*) LUA_JITOFF: stops compiling and running compiled code, and frees
+**     all compiled loops.
+** (*) LUA_JITON: starts compiling hot code. Returns 0 if there is no
+**     compiler for this platform.
+** (*) LUA_JITFLUSH: frees all compiled loops; they are compiled again
+**     when they become hot. Compiled functions live as long as their
+**     prototypes.
+** (*) LUA_JITSTATUS: returns 1 if the compiler is on.
+** (*) LUA_JITCOUNT: returns the number of compiled loops.
+** (*) LUA_JITFUNCS: returns the number of compiled functions.
+**
+** [-0, +0, m]
+*/
+LUA_API int lua_jit (lua_State *L, int what) {
+  int res = 0;
+  lua_lock(L);
+  switch (what) {
+    case LUA_JITOFF: {
+      luaJ_off(L);
+      break;
+    }
+    case LUA_JITON: {
+      res = luaJ_on(L);
+      break;
+    }
+    case LUA_JITFLUSH: {
+      luaJ_flush(L);
+      break;
+    }
+    case LUA_JITSTATUS: {
+      res = (G(L)->jit != NULL);
+      break;
+    }
+    case LUA_JITCOUNT: {
+      res = luaJ_count(L, 0);
+      break;
+    }
+    case LUA_JITFUNCS: {
+      res = luaJ_count(L, 1);
+      break;
+    }
+    default: res = -1;  /* invalid option */
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+
+/*
+** Ahead-of-time compiled code (see `luac -C')
+*/
+
+static int setnative (Proto *p, const lua_Native **f, const lua_Native *end) {
+  int i;
+  if (*f == end) return 0;
+  p->native = *(*f)++;
+  for (i = 0; i < p->sizep; i++)
+    if (!setnative(p->p[i], f, end)) return 0;
+  return 1;
+}
+
+
+static int countprotos (Proto *p) {
+  int i, n = 1;
+  for (i = 0; i < p->sizep; i++)
+    n += countprotos(p->p[i]);
+  return n;
+}
+
+
+/*
+** Attaches the n compiled functions f to the prototypes of the Lua function
+** at the given acceptable index, visiting its nested functions in preorder.
+** Returns -1 if the functions were compiled with another value layout
+** (conf is their LUAI_NATIVECONF), and 0 if n does not match the number of
+** prototypes; in both cases it changes nothing.
+**
+** [-0, +0, -]
+*/
+LUA_API int lua_setnative (lua_State *L, int idx, const lua_Native *f,
+                           int n, int conf) {
+  StkId o;
+  Proto *p;
+  int res = 0;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_check(L, ttisfunction(o) && !clvalue(o)->c.isC);
+  p = clvalue(o)->l.p;
+  if (conf != LUAI_NATIVECONF)
+    res = -1;
+  else if (countprotos(p) == n)
+    res = setnative(p, &f, f + n);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Executes instruction pc of the running Lua function, for the compiled
+** code of the function; returns 1 if the instruction jumps.
+**
+** [-0, +0, e]
+*/
+LUA_API int lua_execop (lua_State *L, int pc) {
+  int res;
+  lua_lock(L);
+  api_check(L, isLua(L->ci));
+  api_check(L, 0 <= pc && pc < ci_func(L->ci)->l.p->sizecode);
+  res = luaJ_execop(L, ci_func(L->ci)->l.p->code + pc);
+  lua_unlock(L);
+  return res;
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1741,3 +1978,123 @@ LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n) {
 }
 
 
+
+
+
+/*
+** Base library functions that the VM runs in place, without a call (see
+** OP_VARSELECT and OP_TFORLOOP). They belong to the core so that the VM can recognize
+** them; lbaselib.c registers them under their usual names. Their errors
+** read exactly as the ones lauxlib gives the other base functions.
+*/
+
+static int argerror (lua_State *L, int narg, const char *extramsg) {
+  lua_Debug ar;
+  if (lua_getstack(L, 1, &ar)) {  /* position of the caller, if any */
+    lua_getinfo(L, "Sl", &ar);
+    if (ar.currentline > 0)
+      lua_pushfstring(L, "%s:%d: ", ar.short_src, ar.currentline);
+    else lua_pushliteral(L, "");
+  }
+  else lua_pushliteral(L, "");
+  if (!lua_getstack(L, 0, &ar))  /* no stack frame? */
+    lua_pushfstring(L, "bad argument #%d (%s)", narg, extramsg);
+  else {
+    lua_getinfo(L, "n", &ar);
+    if (strcmp(ar.namewhat, "method") == 0 && --narg == 0)
+      lua_pushfstring(L, "calling " LUA_QS " on bad self (%s)",
+                      ar.name, extramsg);
+    else
+      lua_pushfstring(L, "bad argument #%d to " LUA_QS " (%s)",
+                      narg, (ar.name == NULL) ? "?" : ar.name, extramsg);
+  }
+  lua_concat(L, 2);
+  return lua_error(L);
+}
+
+
+static int typeerror (lua_State *L, int narg, int t) {
+  const char *msg = lua_pushfstring(L, "%s expected, got %s",
+                                    lua_typename(L, t),
+                                    lua_typename(L, lua_type(L, narg)));
+  return argerror(L, narg, msg);
+}
+
+
+static int checkint (lua_State *L, int narg) {
+  lua_Integer d = lua_tointeger(L, narg);
+  if (d == 0 && !lua_isnumber(L, narg))  /* avoid extra test when d is not 0 */
+    typeerror(L, narg, LUA_TNUMBER);
+  return cast_int(d);
+}
+
+
+static void checktable (lua_State *L, int narg) {
+  if (lua_type(L, narg) != LUA_TTABLE)
+    typeerror(L, narg, LUA_TTABLE);
+}
+
+
+/*
+** select (index, ...)
+**
+** If index is a number, returns all arguments after argument number index.
+** Otherwise, index must be the string "#", and select returns the total number
+** of extra arguments it received.
+*/
+int luaA_select (lua_State *L) {
+  int n = lua_gettop(L);
+  if (lua_type(L, 1) == LUA_TSTRING && *lua_tostring(L, 1) == '#') {
+    lua_pushinteger(L, n-1);
+    return 1;
+  }
+  else {
+    int i = checkint(L, 1);
+    if (i < 0) i = n + i;
+    else if (i > n) i = n;
+    if (i < 1) argerror(L, 1, "index out of range");
+    return n - i;
+  }
+}
+
+
+/*
+** next (table [, index])
+** 
+** Allows a program to traverse all fields of a table. Its first argument is a 
+** table and its second argument is an index in this table. next returns the 
+** next index of the table and its associated value. When called with nil as its
+** second argument, next returns an initial index and its associated value. When
+** called with the last index, or with nil in an empty table, next returns nil. 
+** If the second argument is absent, then it is interpreted as nil. In 
+** particular, you can use next(t) to check whether a table is empty.
+**
+** The order in which the indices are enumerated is not specified, even for 
+** numeric indices. (To traverse a table in numeric order, use a numerical for 
+** or the ipairs function.)
+**
+** The behavior of next is undefined if, during the traversal, you assign any 
+** value to a non-existent field in the table. You may however modify existing 
+** fields. In particular, you may clear existing fields.
+*/
+int luaA_next (lua_State *L) {
+  checktable(L, 1);
+  lua_settop(L, 2);  /* create a 2nd argument if there isn't one */
+  if (lua_next(L, 1))
+    return 2;
+  else {
+    lua_pushnil(L);
+    return 1;
+  }
+}
+
+
+/* iterator that `ipairs' returns */
+int luaA_inext (lua_State *L) {
+  int i = checkint(L, 2);
+  checktable(L, 1);
+  i++;  /* next value */
+  lua_pushinteger(L, i);
+  lua_rawgeti(L, 1, i);
+  return (lua_isnil(L, -1)) ? 0 : 2;
+}
@@ -374,37 +374,6 @@ static int luaB_type (lua_State *L) {
 }
 
 
-/*
-** next (table [, index])
-** 
-** Allows a program to traverse all fields of a table. Its first argument is a 
-** table and its second argument is an index in this table. next returns the 
-** next index of the table and its associated value. When called with nil as its
-** second argument, next returns an initial index and its associated value. When
-** called with the last index, or with nil in an empty table, next returns nil. 
-** If the second argument is absent, then it is interpreted as nil. In 
-** particular, you can use next(t) to check whether a table is empty.
-**
-** The order in which the indices are enumerated is not specified, even for 
-** numeric indices. (To traverse a table in numeric order, use a numerical for 
-** or the ipairs function.)
-**
-** The behavior of next is undefined if, during the traversal, you assign any 
-** value to a non-existent field in the table. You may however modify existing 
-** fields. In particular, you may clear existing fields.
-*/
-static int luaB_next (lua_State *L) {
-  luaL_checktype(L, 1, LUA_TTABLE);
-  lua_settop(L, 2);  /* create a 2nd argument if there isn't one */
-  if (lua_next(L, 1))
-    return 2;
-  else {
-    lua_pushnil(L);
-    return 1;
-  }
-}
-
-
 /*
 ** pairs (t)
 **
@@ -426,16 +395,6 @@ static int luaB_pairs (lua_State *L) {
 }
 
 
-static int ipairsaux (lua_State *L) {
-  int i = luaL_checkint(L, 2);
-  luaL_checktype(L, 1, LUA_TTABLE);
-  i++;  /* next value */
-  lua_pushinteger(L, i);
-  lua_rawgeti(L, 1, i);
-  return (lua_isnil(L, -1)) ? 0 : 2;
-}
-
-
 /*
 ** ipairs (t)
 **
@@ -599,36 +558,11 @@ static int luaB_unpack (lua_State *L) {
   n = e - i + 1;  /* number of elements */
   if (n <= 0 || !lua_checkstack(L, n))  /* n <= 0 means arith. overflow */
     return luaL_error(L, "too many results to unpack");
-  lua_rawgeti(L, 1, i);  /* push arg[i] (avoiding overflow problems) */
-  while (i++ < e)  /* push arg[i + 1...e] */
-    lua_rawgeti(L, 1, i);
+  lua_rawunpack(L, 1, i, e);  /* push arg[i...e] */
   return n;
 }
 
 
-/*
-** select (index, ···)
-**
-** If index is a number, returns all arguments after argument number index. 
-** Otherwise, index must be the string "#", and select returns the total number 
-** of extra arguments it received.
-*/
-static int luaB_select (lua_State *L) {
-  int n = lua_gettop(L);
-  if (lua_type(L, 1) == LUA_TSTRING && *lua_tostring(L, 1) == '#') {
-    lua_pushinteger(L, n-1);
-    return 1;
-  }
-  else {
-    int i = luaL_checkint(L, 1);
-    if (i < 0) i = n + i;
-    else if (i > n) i = n;
-    luaL_argcheck(L, 1 <= i, 1, "index out of range");
-    return n - i;
-  }
-}
-
-
 /*
 ** pcall (f, arg1, ···)
 **
@@ -747,13 +681,13 @@ static const luaL_Reg base_funcs[] = {
   {"loadfile", luaB_loadfile},
   {"load", luaB_load},
   {"loadstring", luaB_loadstring},
-  {"next", luaB_next},
+  {"next", luaA_next},
   {"pcall", luaB_pcall},
   {"print", luaB_print},
   {"rawequal", luaB_rawequal},
   {"rawget", luaB_rawget},
   {"rawset", luaB_rawset},
-  {"select", luaB_select},
+  {"select", luaA_select},
   {"setfenv", luaB_setfenv},
   {"setmetatable", luaB_setmetatable},
   {"tonumber", luaB_tonumber},
@@ -973,8 +907,8 @@ static void base_open (lua_State *L) {
   lua_pushliteral(L, LUA_VERSION);
   lua_setglobal(L, "_VERSION");  /* set global _VERSION */
   /* `ipairs' and `pairs' need auxiliary functions as upvalues */
-  auxopen(L, "ipairs", luaB_ipairs, ipairsaux);
-  auxopen(L, "pairs", luaB_pairs, luaB_next);
+  auxopen(L, "ipairs", luaB_ipairs, luaA_inext);
+  auxopen(L, "pairs", luaB_pairs, luaA_next);
   /* `newproxy' needs a weaktable as upvalue */
   lua_createtable(L, 0, 1);  /* new table `w' */
   lua_pushvalue(L, -1);  /* `w' will be its own metatable */
@@ -283,7 +283,7 @@ int luaK_stringK (FuncState *fs, TString *s) {
 (TODO: comment on "numeric problems")*/
 int luaK_numberK (FuncState *fs, lua_Number r) {
   TValue o;
-  setnvalue(&o, r);
+  setnumber(&o, r);
   return addk(fs, &o, &o);
 }
 
@@ -915,3 +915,67 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
 }
 
 
+
+
+/*
+** Superinstructions: fuse frequent pairs of instructions, where the
+** first one feeds the second, so that the interpreter goes from the
+** first word straight into the handler of the second one instead of
+** through a dispatch. Only the opcode of the first word changes (to a
+** specialized form, see `luaP_opbase'); both keep their operands, line
+** info and positions, so jumps into the second word and everything that
+** reads generic opcodes are not affected. Runs on final code only.
+*/
+static OpCode fusedop (Instruction i, Instruction next) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {  /* move into the call frame */
+      if (GET_OPCODE(next) == OP_CALL && GETARG_A(i) >= GETARG_A(next))
+        return OP_MOVECALL;
+      break;
+    }
+    case OP_GETTABLE: {  /* field into the call frame */
+      if (GET_OPCODE(next) == OP_CALL && GETARG_A(i) >= GETARG_A(next))
+        return OP_GETTABLECALL;
+      break;
+    }
+    case OP_GETUPVAL: {  /* field of an upvalue */
+      if (GET_OPCODE(next) == OP_GETTABLE && GETARG_B(next) == GETARG_A(i))
+        return OP_GETUPVALTABLE;
+      break;
+    }
+    case OP_VARARG: {  /* `f(x, ...)', as in `select(n, ...)' */
+      if (GETARG_B(i) == 0 && GET_OPCODE(next) == OP_CALL &&
+          GETARG_B(next) == 0 && GETARG_A(i) == GETARG_A(next) + 2)
+        return OP_VARSELECT;
+      break;
+    }
+    default: break;
+  }
+  return GET_OPCODE(i);
+}
+
+
+void luaK_fuse (Proto *f) {
+  Instruction *code = f->code;
+  int pc;
+  for (pc = 0; pc + 1 < f->sizecode; pc++) {
+    Instruction i = code[pc];
+    OpCode o;
+    switch (GET_OPCODE(i)) {
+      case OP_CLOSURE: {  /* skip pseudo-instructions for upvalues */
+        pc += f->p[GETARG_Bx(i)]->nups;
+        continue;
+      }
+      case OP_SETLIST: {  /* skip extra argument */
+        if (GETARG_C(i) == 0) pc++;
+        continue;
+      }
+      default: break;
+    }
+    o = fusedop(i, code[pc+1]);
+    if (o != GET_OPCODE(i)) {
+      SET_OPCODE(code[pc], o);
+      pc++;  /* second word cannot start another pair */
+    }
+  }
+}
@@ -51,7 +51,10 @@ static int currentline (lua_State *L, CallInfo *ci) {
 
 
 /*
-** this function can be called asynchronous (e.g. during a signal)
+** this function can be called asynchronous (e.g. during a signal).
+** A running `luaV_execute' picks the new mask up at its next call,
+** protected operation or backward jump, where it switches between its
+** hooked and unhooked dispatch (see `updatedisp' in lvm.c).
 */
 LUA_API int lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
   if (func == NULL || mask == 0) {  /* turn off hooks? */
@@ -359,6 +362,7 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
     int b = 0;
     int c = 0;
     check(op < NUM_OPCODES);
+    op = cast(OpCode, luaP_opbase[op]);  /* running code may be quickened */
     checkreg(pt, a);
     switch (getOpMode(op)) {
       case iABC: {
@@ -515,6 +519,11 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
 
 
 int luaG_checkcode (const Proto *pt) {
+  int pc;
+  for (pc = 0; pc < pt->sizecode; pc++) {  /* no run-time forms in chunks */
+    OpCode op = GET_OPCODE(pt->code[pc]);
+    if (op >= NUM_OPCODES || isquickened(op)) return 0;
+  }
   return (symbexec(pt, pt->sizecode, NO_REG) != 0);
 }
 
@@ -538,7 +547,7 @@ static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
       return "local";
     i = symbexec(p, pc, stackpos);  /* try symbolic execution */
     lua_assert(pc != -1);
-    switch (GET_OPCODE(i)) {
+    switch (luaP_opbase[GET_OPCODE(i)]) {
       case OP_GETGLOBAL: {
         int g = GETARG_Bx(i);  /* global index */
         lua_assert(ttisstring(&p->k[g]));
@@ -12,6 +12,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -73,7 +74,17 @@ static void DumpString(const TString* s, DumpState* D)
  }
 }
 
-#define DumpCode(f,D)	 DumpVector(f->code,f->sizecode,sizeof(Instruction),D)
+static void DumpCode(const Proto* f, DumpState* D)
+{
+ int i,n=f->sizecode;
+ DumpInt(n,D);
+ for (i=0; i<n; i++)			/* save quickened code in generic form */
+ {
+  Instruction c=f->code[i];
+  SET_OPCODE(c,luaP_opbase[GET_OPCODE(c)]);
+  DumpVar(c,D);
+ }
+}
 
 static void DumpFunction(const Proto* f, const TString* p, DumpState* D);
 
@@ -14,6 +14,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -121,6 +122,11 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->sizecode = 0;
+  f->cache = NULL;
+  f->sizecache = 0;
+  f->jitcode = NULL;
+  f->native = NULL;
+  f->ncalls = 0;
   f->sizelineinfo = 0;
   f->sizeupvalues = 0;
   f->nups = 0;
@@ -138,8 +144,22 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** create the inline caches of a finished prototype, one slot per
+** instruction (see `luaH_getstrc')
+*/
+void luaF_newcache (lua_State *L, Proto *f) {
+  int i;
+  luaM_reallocvector(L, f->cache, f->sizecache, f->sizecode, int);
+  f->sizecache = f->sizecode;
+  for (i = 0; i < f->sizecache; i++) f->cache[i] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
+  luaJ_freecode(L, f);  /* uses `sizecode' */
   luaM_freearray(L, f->code, f->sizecode, Instruction);
+  luaM_freearray(L, f->cache, f->sizecache, int);
   luaM_freearray(L, f->p, f->sizep, Proto *);
   luaM_freearray(L, f->k, f->sizek, TValue);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
@@ -108,6 +108,14 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       g->gray = o;
       break;
     }
+    case LUA_TSHAPE: {
+      Shape *s = gco2sh(o);
+      gray2black(o);  /* shapes are never gray */
+      /* other keys are the parent's */
+      if (s->nkeys > 0) stringmark(s->keys[s->nkeys - 1]);
+      if (s->parent) markobject(g, s->parent);
+      return;
+    }
     default: lua_assert(0);
   }
 }
@@ -157,6 +165,23 @@ size_t luaC_separateudata (lua_State *L, int all) {
 }
 
 
+static void traversenodes (global_State *g, Table *h, int weakkey,
+                                                      int weakvalue) {
+  int i = sizenode(h);
+  while (i--) {
+    Node *n = gnode(h, i);
+    lua_assert(ttype(gkey(n)) != LUA_TDEADKEY || ttisnil(gval(n)));
+    if (ttisnil(gval(n)))
+      removeentry(n);  /* remove empty entries */
+    else {
+      lua_assert(!ttisnil(gkey(n)));
+      if (!weakkey) markvalue(g, gkey(n));
+      if (!weakvalue) markvalue(g, gval(n));
+    }
+  }
+}
+
+
 static int traversetable (global_State *g, Table *h) {
   int i;
   int weakkey = 0;
@@ -164,6 +189,8 @@ static int traversetable (global_State *g, Table *h) {
   const TValue *mode;
   if (h->metatable)
     markobject(g, h->metatable);
+  if (h->shape)  /* string keys are never weak */
+    markobject(g, h->shape);
   mode = gfasttm(g, h->metatable, TM_MODE);
   if (mode && ttisstring(mode)) {  /* is there a weak mode? */
     weakkey = (strchr(svalue(mode), 'k') != NULL);
@@ -178,22 +205,16 @@ static int traversetable (global_State *g, Table *h) {
   }
   if (weakkey && weakvalue) return 1;
   if (!weakvalue) {
-    i = h->sizearray;
+    i = ispacked(h) ? 0 : h->sizearray;  /* packed numbers need no marks */
     while (i--)
       markvalue(g, &h->array[i]);
+    i = h->sizeslots;
+    while (i--)
+      markvalue(g, &h->slots[i]);
   }
-  i = sizenode(h);
-  while (i--) {
-    Node *n = gnode(h, i);
-    lua_assert(ttype(gkey(n)) != LUA_TDEADKEY || ttisnil(gval(n)));
-    if (ttisnil(gval(n)))
-      removeentry(n);  /* remove empty entries */
-    else {
-      lua_assert(!ttisnil(gkey(n)));
-      if (!weakkey) markvalue(g, gkey(n));
-      if (!weakvalue) markvalue(g, gval(n));
-    }
-  }
+  traversenodes(g, h, weakkey, weakvalue);
+  if (h->old)  /* keys not moved yet to the grown hash part */
+    traversenodes(g, &h->old->h, weakkey, weakvalue);
   return weakkey || weakvalue;
 }
 
@@ -291,8 +312,11 @@ static l_mem propagatemark (global_State *g) {
 	  /* 遍历mark引用的值，放入gray链表 */
       if (traversetable(g, h))  /* table is weak? */
         black2gray(o);  /* keep it gray */
-      return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                             sizeof(Node) * sizenode(h);
+      return sizeof(Table) +
+             (ispacked(h) ? 0 : sizeof(TValue) * h->sizearray) +
+             sizeof(TValue) * h->sizeslots +
+             sizeof(Node) * sizenode(h) +
+             (h->old ? sizeof(Node)*sizenode(&h->old->h) : 0);
     }
     case LUA_TFUNCTION: {
       /* gray = next */
@@ -324,6 +348,7 @@ static l_mem propagatemark (global_State *g) {
 
       traverseproto(g, p);
       return sizeof(Proto) + sizeof(Instruction) * p->sizecode +
+                             sizeof(int) * p->sizecache +
                              sizeof(Proto *) * p->sizep +
                              sizeof(TValue) * p->sizek + 
                              sizeof(int) * p->sizelineinfo +
@@ -360,13 +385,26 @@ static int iscleared (const TValue *o, int iskey) {
 }
 
 
+static void clearnodes (Table *h) {
+  int i = sizenode(h);
+  while (i--) {
+    Node *n = gnode(h, i);
+    if (!ttisnil(gval(n)) &&  /* non-empty entry? */
+        (iscleared(key2tval(n), 1) || iscleared(gval(n), 0))) {
+      setnilvalue(gval(n));  /* remove value ... */
+      removeentry(n);  /* remove entry from table */
+    }
+  }
+}
+
+
 /*
 ** clear collected entries from weaktables
 */
 static void cleartable (GCObject *l) {
   while (l) {
     Table *h = gco2h(l);
-    int i = h->sizearray;
+    int i = ispacked(h) ? 0 : h->sizearray;
     lua_assert(testbit(h->marked, VALUEWEAKBIT) ||
                testbit(h->marked, KEYWEAKBIT));
     if (testbit(h->marked, VALUEWEAKBIT)) {
@@ -375,16 +413,15 @@ static void cleartable (GCObject *l) {
         if (iscleared(o, 0))  /* value was collected? */
           setnilvalue(o);  /* remove value */
       }
-    }
-    i = sizenode(h);
-    while (i--) {
-      Node *n = gnode(h, i);
-      if (!ttisnil(gval(n)) &&  /* non-empty entry? */
-          (iscleared(key2tval(n), 1) || iscleared(gval(n), 0))) {
-        setnilvalue(gval(n));  /* remove value ... */
-        removeentry(n);  /* remove entry from table */
+      i = h->sizeslots;
+      while (i--) {
+        TValue *o = &h->slots[i];
+        if (iscleared(o, 0))  /* value was collected? */
+          setnilvalue(o);  /* remove value */
       }
     }
+    clearnodes(h);
+    if (h->old) clearnodes(&h->old->h);
     l = h->gclist;
   }
 }
@@ -396,6 +433,7 @@ static void freeobj (lua_State *L, GCObject *o) {
     case LUA_TFUNCTION: luaF_freeclosure(L, gco2cl(o)); break;
     case LUA_TUPVAL: luaF_freeupval(L, gco2uv(o)); break;
     case LUA_TTABLE: luaH_free(L, gco2h(o)); break;
+    case LUA_TSHAPE: luaH_freeshape(L, gco2sh(o)); break;
     case LUA_TTHREAD: {
       lua_assert(gco2th(o) != L && gco2th(o) != G(L)->mainthread);
       luaE_freethread(L, gco2th(o));
@@ -450,6 +488,10 @@ static void checkSizes (lua_State *L) {
   if (g->strt.nuse < cast(lu_int32, g->strt.size/4) &&
       g->strt.size > MINSTRTABSIZE*2)
     luaS_resize(L, g->strt.size/2);  /* table is too big */
+  /* check size of shape hash */
+  if (g->shapet.nuse < cast(lu_int32, g->shapet.size/4) &&
+      g->shapet.size > MINSTRTABSIZE*2)
+    luaH_resizeshapes(L, g->shapet.size/2);  /* table is too big */
   /* check size of buffer */
   if (luaZ_sizebuffer(&g->buff) > LUA_MINBUFFER*2) {  /* buffer too big? */
     size_t newsize = luaZ_sizebuffer(&g->buff) / 2;
@@ -563,6 +605,7 @@ static void atomic (lua_State *L) {
   marktmu(g);  /* mark `preserved' userdata */
   udsize += propagateall(g);  /* remark, to propagate `preserveness' */
   cleartable(g->weak);  /* remove collected objects from weak tables */
+  luaT_mcflush(L);  /* cached keys and metatables may be freed from now on */
   /* flip current white */
   g->currentwhite = cast_byte(otherwhite(g));
   g->sweepstrgc = 0;
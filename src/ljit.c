@@ -0,0 +1,1635 @@
+/*
+** $Id: ljit.c $
+** Compilation of Lua code to machine code
+** See Copyright Notice in lua.h
+*/
+
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+
+/*
+** {======================================================
+** Helpers of compiled functions
+** =======================================================
+*/
+
+/*
+** Each helper executes the instruction at `pc' as `luaV_execute' does
+** (including its inline caches); conditional ones return whether the
+** jump is taken. They serve both the code compiled here and the C code
+** generated by `luac -C' (through `lua_execop').
+*/
+typedef int (*JHelper) (lua_State *L, const Instruction *pc);
+
+#define hcl(L)		(&curr_func(L)->l)
+#define hcache(cl,pc)	((cl)->p->cache + ((pc) - (cl)->p->code))
+#define HRA(i)		(L->base + GETARG_A(i))
+#define HRB(i)		(L->base + GETARG_B(i))
+#define HRK(x)		(ISK(x) ? k+INDEXK(x) : L->base+(x))
+
+
+static int h_getupval (lua_State *L, const Instruction *pc) {
+  setobj2s(L, HRA(*pc), hcl(L)->upvals[GETARG_B(*pc)]->v);
+  return 0;
+}
+
+
+static int h_getglobal (lua_State *L, const Instruction *pc) {
+  LClosure *cl = hcl(L);
+  Table *h = cl->env;
+  TValue *rb = cl->p->k + GETARG_Bx(*pc);
+  const TValue *res = luaH_getstrc(h, rawtsvalue(rb), hcache(cl, pc));
+  TValue g;
+  if (!ttisnil(res) || fasttm(L, h->metatable, TM_INDEX) == NULL) {
+    setobj2s(L, HRA(*pc), res);
+    return 0;
+  }
+  sethvalue(L, &g, h);
+  L->savedpc = pc + 1;
+  luaV_gettable(L, &g, rb, HRA(*pc));
+  return 0;
+}
+
+
+static int h_gettable (lua_State *L, const Instruction *pc) {
+  LClosure *cl = hcl(L);
+  TValue *k = cl->p->k;
+  StkId rb = HRB(*pc);
+  TValue *rc = HRK(GETARG_C(*pc));
+  if (ttistable(rb) && ttisstring(rc)) {  /* field access? */
+    Table *h = hvalue(rb);
+    const TValue *res = luaH_getstrc(h, rawtsvalue(rc), hcache(cl, pc));
+    if (!ttisnil(res) || fasttm(L, h->metatable, TM_INDEX) == NULL) {
+      setobj2s(L, HRA(*pc), res);
+      return 0;
+    }
+  }
+  L->savedpc = pc + 1;
+  luaV_gettable(L, rb, rc, HRA(*pc));
+  return 0;
+}
+
+
+static int h_setglobal (lua_State *L, const Instruction *pc) {
+  LClosure *cl = hcl(L);
+  Table *h = cl->env;
+  StkId ra = HRA(*pc);
+  TValue *rb = cl->p->k + GETARG_Bx(*pc);
+  TValue *slot = cast(TValue *,
+                      luaH_getstrc(h, rawtsvalue(rb), hcache(cl, pc)));
+  TValue g;
+  if (slot != luaO_nilobject &&
+      (!ttisnil(slot) || fasttm(L, h->metatable, TM_NEWINDEX) == NULL)) {
+    luaT_mcwrite(L, h);
+    setobj2t(L, slot, ra);
+    h->flags = 0;
+    luaC_barriert(L, h, ra);
+    return 0;
+  }
+  sethvalue(L, &g, h);
+  L->savedpc = pc + 1;
+  luaV_settable(L, &g, rb, ra);
+  return 0;
+}
+
+
+static int h_setupval (lua_State *L, const Instruction *pc) {
+  UpVal *uv = hcl(L)->upvals[GETARG_B(*pc)];
+  StkId ra = HRA(*pc);
+  setobj(L, uv->v, ra);
+  luaC_barrier(L, uv, ra);
+  return 0;
+}
+
+
+static int h_settable (lua_State *L, const Instruction *pc) {
+  LClosure *cl = hcl(L);
+  TValue *k = cl->p->k;
+  StkId ra = HRA(*pc);
+  TValue *rb = HRK(GETARG_B(*pc));
+  TValue *rc = HRK(GETARG_C(*pc));
+  if (ttistable(ra) && ttisstring(rb)) {  /* field store? */
+    Table *h = hvalue(ra);
+    TValue *slot = cast(TValue *,
+                        luaH_getstrc(h, rawtsvalue(rb), hcache(cl, pc)));
+    if (slot != luaO_nilobject &&
+        (!ttisnil(slot) || fasttm(L, h->metatable, TM_NEWINDEX) == NULL)) {
+      luaT_mcwrite(L, h);
+      setobj2t(L, slot, rc);
+      h->flags = 0;
+      luaC_barriert(L, h, rc);
+      return 0;
+    }
+  }
+  L->savedpc = pc + 1;
+  luaV_settable(L, ra, rb, rc);
+  return 0;
+}
+
+
+static int h_newtable (lua_State *L, const Instruction *pc) {
+  int b = GETARG_B(*pc);
+  int c = GETARG_C(*pc);
+  L->savedpc = pc + 1;
+  sethvalue(L, HRA(*pc), luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
+  luaC_checkGC(L);
+  return 0;
+}
+
+
+static int h_self (lua_State *L, const Instruction *pc) {
+  LClosure *cl = hcl(L);
+  TValue *k = cl->p->k;
+  StkId ra = HRA(*pc);
+  StkId rb = HRB(*pc);
+  TValue *rc = HRK(GETARG_C(*pc));
+  setobjs2s(L, ra+1, rb);
+  if (ttisstring(rc)) {  /* try the inline and method caches */
+    TString *key = rawtsvalue(rc);
+    const TValue *res = NULL;
+    Table *mt;
+    if (ttistable(rb)) {
+      Table *h = hvalue(rb);
+      res = luaH_getstrc(h, key, hcache(cl, pc));
+      mt = h->metatable;
+      if (ttisnil(res) && mt != NULL)
+        res = luaV_getmethod(L, mt, key);
+    }
+    else {
+      mt = ttisuserdata(rb) ? uvalue(rb)->metatable : G(L)->mt[ttype(rb)];
+      if (mt != NULL)
+        res = luaV_getmethod(L, mt, key);
+    }
+    if (res != NULL) {
+      setobj2s(L, ra, res);
+      return 0;
+    }
+  }
+  L->savedpc = pc + 1;
+  luaV_gettable(L, rb, rc, ra);
+  return 0;
+}
+
+
+/* OP_ADD ... OP_UNM, in the same order as their tag methods */
+static int h_arith (lua_State *L, const Instruction *pc) {
+  TValue *k = hcl(L)->p->k;
+  OpCode op = luaP_opbase[GET_OPCODE(*pc)];
+  TValue *rb = HRK(GETARG_B(*pc));
+  TValue *rc = (op == OP_UNM) ? rb : HRK(GETARG_C(*pc));
+  L->savedpc = pc + 1;
+  luaV_arith(L, HRA(*pc), rb, rc, cast(TMS, TM_ADD + (op - OP_ADD)));
+  return 0;
+}
+
+
+static int h_len (lua_State *L, const Instruction *pc) {
+  L->savedpc = pc + 1;
+  luaV_objlen(L, HRA(*pc), HRB(*pc));
+  return 0;
+}
+
+
+static int h_concat (lua_State *L, const Instruction *pc) {
+  int b = GETARG_B(*pc);
+  int c = GETARG_C(*pc);
+  L->savedpc = pc + 1;
+  luaV_concat(L, c-b+1, c);
+  luaC_checkGC(L);
+  setobjs2s(L, HRA(*pc), L->base + b);
+  return 0;
+}
+
+
+static int h_eq (lua_State *L, const Instruction *pc) {
+  TValue *k = hcl(L)->p->k;
+  TValue *rb = HRK(GETARG_B(*pc));
+  TValue *rc = HRK(GETARG_C(*pc));
+  L->savedpc = pc + 1;
+  return (equalobj(L, rb, rc) == GETARG_A(*pc));
+}
+
+
+static int h_lt (lua_State *L, const Instruction *pc) {
+  TValue *k = hcl(L)->p->k;
+  L->savedpc = pc + 1;
+  return (luaV_lessthan(L, HRK(GETARG_B(*pc)), HRK(GETARG_C(*pc))) ==
+          GETARG_A(*pc));
+}
+
+
+static int h_le (lua_State *L, const Instruction *pc) {
+  TValue *k = hcl(L)->p->k;
+  L->savedpc = pc + 1;
+  return (luaV_lessequal(L, HRK(GETARG_B(*pc)), HRK(GETARG_C(*pc))) ==
+          GETARG_A(*pc));
+}
+
+
+static int h_forprep (lua_State *L, const Instruction *pc) {
+  L->savedpc = pc + 1;
+  luaV_forprep(L, HRA(*pc));
+  return 0;
+}
+
+
+static int h_tforloop (lua_State *L, const Instruction *pc) {
+  StkId cb = HRA(*pc) + 3;  /* call base */
+  if (!luaV_tforstep(L, cb-3, GETARG_C(*pc), hcache(hcl(L), pc))) {
+    setobjs2s(L, cb+2, cb-1);
+    setobjs2s(L, cb+1, cb-2);
+    setobjs2s(L, cb, cb-3);
+    L->top = cb+3;  /* func. + 2 args (state and index) */
+    L->savedpc = pc + 1;
+    luaD_call(L, cb, GETARG_C(*pc));
+    L->top = L->ci->top;
+    cb = HRA(*pc) + 3;  /* previous call may change the stack */
+  }
+  if (!ttisnil(cb)) {  /* continue loop? */
+    setobjs2s(L, cb-1, cb);  /* save control variable */
+    return 1;
+  }
+  return 0;
+}
+
+
+static int h_setlist (lua_State *L, const Instruction *pc) {
+  StkId ra = HRA(*pc);
+  int n = GETARG_B(*pc);
+  int c = GETARG_C(*pc);
+  int last;
+  Table *h;
+  if (n == 0) {
+    n = cast_int(L->top - ra) - 1;
+    L->top = L->ci->top;
+  }
+  if (c == 0) c = cast_int(*(pc+1));
+  if (!ttistable(ra)) return 0;
+  h = hvalue(ra);
+  last = ((c-1)*LFIELDS_PER_FLUSH) + n;
+  L->savedpc = pc + 1;
+  if (last > h->sizearray)  /* needs more space? */
+    luaH_resizearray(L, h, last);  /* pre-alloc it at once */
+  for (; n > 0; n--) {
+    TValue *val = ra+n;
+    last--;  /* position `last' (from 0) is in the array part */
+    setarray(L, h, last, val);
+  }
+  return 0;
+}
+
+
+static int h_close (lua_State *L, const Instruction *pc) {
+  luaF_close(L, HRA(*pc));
+  return 0;
+}
+
+
+static int h_closure (lua_State *L, const Instruction *pc) {
+  LClosure *cl = hcl(L);
+  Proto *p = cl->p->p[GETARG_Bx(*pc)];
+  int nup = p->nups;
+  Closure *ncl;
+  int j;
+  L->savedpc = pc + 1;
+  ncl = luaF_newLclosure(L, nup, cl->env);
+  ncl->l.p = p;
+  for (j=0; j<nup; j++) {
+    Instruction u = pc[j+1];
+    if (GET_OPCODE(u) == OP_GETUPVAL)
+      ncl->l.upvals[j] = cl->upvals[GETARG_B(u)];
+    else {
+      lua_assert(GET_OPCODE(u) == OP_MOVE);
+      ncl->l.upvals[j] = luaF_findupval(L, L->base + GETARG_B(u));
+    }
+  }
+  setclvalue(L, HRA(*pc), ncl);
+  L->savedpc = pc + 1 + nup;
+  luaC_checkGC(L);
+  return 0;
+}
+
+
+static int h_vararg (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = L->ci;
+  int b = GETARG_B(*pc) - 1;
+  int n = cast_int(ci->base - ci->func) - hcl(L)->p->numparams - 1;
+  int j;
+  StkId ra;
+  if (b == LUA_MULTRET) {
+    L->savedpc = pc + 1;
+    luaD_checkstack(L, n);
+    b = n;
+    L->top = HRA(*pc) + n;
+  }
+  ra = HRA(*pc);
+  for (j = 0; j < b; j++) {
+    if (j < n) {
+      setobjs2s(L, ra + j, ci->base - n + j);
+    }
+    else {
+      setnilvalue(ra + j);
+    }
+  }
+  return 0;
+}
+
+int luaJ_execop (lua_State *L, const Instruction *pc) {
+  switch (luaP_opbase[GET_OPCODE(*pc)]) {
+    case OP_GETUPVAL: return h_getupval(L, pc);
+    case OP_GETGLOBAL: return h_getglobal(L, pc);
+    case OP_GETTABLE: return h_gettable(L, pc);
+    case OP_SETGLOBAL: return h_setglobal(L, pc);
+    case OP_SETUPVAL: return h_setupval(L, pc);
+    case OP_SETTABLE: return h_settable(L, pc);
+    case OP_NEWTABLE: return h_newtable(L, pc);
+    case OP_SELF: return h_self(L, pc);
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    case OP_MOD: case OP_POW: case OP_UNM: return h_arith(L, pc);
+    case OP_LEN: return h_len(L, pc);
+    case OP_CONCAT: return h_concat(L, pc);
+    case OP_EQ: return h_eq(L, pc);
+    case OP_LT: return h_lt(L, pc);
+    case OP_LE: return h_le(L, pc);
+    case OP_FORPREP: return h_forprep(L, pc);
+    case OP_TFORLOOP: return h_tforloop(L, pc);
+    case OP_SETLIST: return h_setlist(L, pc);
+    case OP_CLOSE: return h_close(L, pc);
+    case OP_CLOSURE: return h_closure(L, pc);
+    case OP_VARARG: return h_vararg(L, pc);
+    default: {
+      lua_assert(0);  /* other instructions are always compiled inline */
+      return 0;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+
+#if defined(LUA_USE_JIT)
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+/*
+** A loop is recorded by interpreting one iteration of its body here,
+** remembering each instruction executed and the outcome of each branch.
+** The resulting linear trace is compiled to x86-64 code that runs the
+** whole loop, with a guard on every assumption made while recording
+** (value types, array bounds, branch directions). A failed guard
+** returns the pc of the instruction that made the assumption, and the
+** interpreter resumes the iteration from there.
+**
+** Only a small subset of the instruction set is compiled: moves,
+** constants, upvalue reads, array-part table accesses with numeric
+** keys, number arithmetic, comparisons and tests. Any other instruction,
+** a nested loop or a call makes the loop uncompilable.
+**
+** Functions called HOTCALL times are compiled as a whole, one template
+** per instruction: moves, number arithmetic and comparisons, tests and
+** numeric loops are inlined, everything else calls a helper doing what
+** the interpreter does. Calls and returns leave the compiled code, so
+** the interpreter handles all frame changes (and call/return hooks); it
+** reenters the compiled code at the next `reentry' of `luaV_execute'.
+*/
+
+
+/* maximum number of instructions in a trace */
+#define MAXTRACE	200
+
+/* maximum number of traces */
+#define MAXTRACES	1024
+
+/* size of the code buffer; larger functions are not compiled */
+#define MAXMCODE	(64*1024)
+
+/* maximum number of guards in a trace */
+#define MAXEXITS	(MAXTRACE*4)
+
+
+/* values of a loop slot in `Proto.cache' that are not counters */
+#define BLACKLISTED	(-1)
+#define slot2trace(s)	(-(s)-2)
+#define trace2slot(t)	(-(t)-2)
+
+
+typedef struct Trace {
+  Proto *p;  /* prototype and pc of the loop (validated before each use) */
+  int loop;
+  void *mcode;  /* machine code */
+  size_t szmcode;
+} Trace;
+
+
+typedef struct JitCode {
+  void *mcode;  /* machine code */
+  size_t szmcode;
+  int entry;  /* offset of the entry point in `mcode' */
+  int ofs[1];  /* offset of the code of each instruction */
+} JitCode;
+
+#define sizejitcode(n)	(sizeof(JitCode) + ((n)-1)*sizeof(int))
+
+
+typedef struct JitState {
+  Trace *traces;
+  int ntraces;
+  int sizetraces;
+  int nfuncs;  /* number of compiled functions */
+  /* code generation */
+  unsigned char mcode[MAXMCODE];
+  int nmc;
+  int exitat[MAXEXITS];  /* position of each guard's jump offset... */
+  int exitpc[MAXEXITS];  /* ...and the pc to resume at */
+  int nexits;
+  int *ofs;  /* instruction offsets of the function being compiled */
+  int fail;  /* code buffer overflow */
+} JitState;
+
+
+typedef struct TraceIns {
+  Instruction i;  /* instruction in its generic form */
+  int pc;
+  int taken;  /* outcome of a conditional instruction, or the table of a
+                 GETTABLE or SETTABLE had a packed array part */
+} TraceIns;
+
+
+typedef struct RecState {
+  TraceIns ins[MAXTRACE];
+  int n;
+  int up;  /* step was positive */
+} RecState;
+
+
+/* outcome of a recording */
+#define REC_DONE	0	/* reached the end of the loop body */
+#define REC_ABORT	1	/* path or types not traceable now; retry later */
+#define REC_NYI		2	/* loop cannot be compiled */
+
+
+
+/*
+** {======================================================
+** Recorder
+** =======================================================
+*/
+
+#define RKR(x)	(ISK(x) ? k+INDEXK(x) : base+(x))
+
+
+/* position of `t[key]' in the array part of table `t', or -1 */
+static int arrayslot (const TValue *t, const TValue *key) {
+  if (ttistable(t) && ttisnumber(key)) {
+    Table *h = hvalue(t);
+    lua_Number n = nvalue(key);
+    int idx;
+    lua_number2int(idx, n);
+    if (luai_numeq(cast_num(idx), n) &&
+        cast(unsigned int, idx-1) < cast(unsigned int, h->sizearray))
+      return idx-1;
+  }
+  return -1;
+}
+
+
+/* target of the jump following a test at `pc' */
+#define testjump(code,pc)	((pc) + 2 + GETARG_sBx((code)[(pc)+1]))
+
+
+static int record (lua_State *L, LClosure *cl, RecState *R, int head,
+                   int loop, int *stop) {
+  StkId base = L->base;
+  const TValue *k = cl->p->k;
+  const Instruction *code = cl->p->code;
+  int pc = head;
+  R->n = 0;
+  while (pc != loop) {
+    Instruction i = code[pc];
+    OpCode op = luaP_opbase[GET_OPCODE(i)];
+    StkId ra = base + GETARG_A(i);
+    int next = pc + 1;
+    int taken = 0;
+    *stop = pc;
+    if (R->n == MAXTRACE) return REC_NYI;
+    switch (op) {
+      case OP_MOVE: {
+        setobjs2s(L, ra, base + GETARG_B(i));
+        break;
+      }
+      case OP_LOADK: {
+        setobj2s(L, ra, k + GETARG_Bx(i));
+        break;
+      }
+      case OP_LOADBOOL: {
+        if (GETARG_C(i)) next++;
+        if (next > loop) return REC_NYI;
+        setbvalue(ra, GETARG_B(i));
+        break;
+      }
+      case OP_LOADNIL: {
+        StkId rb = base + GETARG_B(i);
+        do {
+          setnilvalue(rb--);
+        } while (rb >= ra);
+        break;
+      }
+      case OP_GETUPVAL: {
+        setobj2s(L, ra, cl->upvals[GETARG_B(i)]->v);
+        break;
+      }
+      case OP_GETTABLE: {
+        const TValue *rb = base + GETARG_B(i);
+        int n = arrayslot(rb, RKR(GETARG_C(i)));
+        Table *h;
+        if (n < 0 || arrisnil(hvalue(rb), n)) return REC_ABORT;
+        h = hvalue(rb);
+        taken = ispacked(h);
+        getarray(L, h, n, ra);
+        break;
+      }
+      case OP_SETTABLE: {
+        int n = arrayslot(ra, RKR(GETARG_B(i)));
+        const TValue *rc = RKR(GETARG_C(i));
+        Table *h;
+        if (n < 0 || arrisnil(hvalue(ra), n) || iscollectable(rc))
+          return REC_ABORT;
+        h = hvalue(ra);
+        if (ispacked(h) && !ttisnumber(rc))
+          return REC_ABORT;  /* would unpack it */
+        taken = ispacked(h);
+        setarray(L, h, n, rc);
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: {
+        const TValue *rb = RKR(GETARG_B(i));
+        const TValue *rc = RKR(GETARG_C(i));
+        lua_Number nb, nc;
+        if (!ttisnumber(rb) || !ttisnumber(rc)) return REC_ABORT;
+        nb = nvalue(rb); nc = nvalue(rc);
+        switch (op) {
+          case OP_ADD: setnvalue(ra, luai_numadd(nb, nc)); break;
+          case OP_SUB: setnvalue(ra, luai_numsub(nb, nc)); break;
+          case OP_MUL: setnvalue(ra, luai_nummul(nb, nc)); break;
+          default: setnvalue(ra, luai_numdiv(nb, nc)); break;
+        }
+        break;
+      }
+      case OP_UNM: {
+        const TValue *rb = base + GETARG_B(i);
+        if (!ttisnumber(rb)) return REC_ABORT;
+        setnvalue(ra, luai_numunm(nvalue(rb)));
+        break;
+      }
+      case OP_NOT: {
+        int res = l_isfalse(base + GETARG_B(i));
+        setbvalue(ra, res);
+        break;
+      }
+      case OP_JMP: {
+        next += GETARG_sBx(i);
+        break;
+      }
+      case OP_EQ: case OP_LT: case OP_LE: {
+        const TValue *rb = RKR(GETARG_B(i));
+        const TValue *rc = RKR(GETARG_C(i));
+        int res;
+        if (!ttisnumber(rb) || !ttisnumber(rc)) return REC_ABORT;
+        if (op == OP_EQ) res = luai_numeq(nvalue(rb), nvalue(rc));
+        else if (op == OP_LT) res = luai_numlt(nvalue(rb), nvalue(rc));
+        else res = luai_numle(nvalue(rb), nvalue(rc));
+        taken = (res == GETARG_A(i));
+        next = taken ? testjump(code, pc) : pc + 2;
+        break;
+      }
+      case OP_TEST: {
+        taken = (l_isfalse(ra) != GETARG_C(i));
+        next = taken ? testjump(code, pc) : pc + 2;
+        break;
+      }
+      case OP_TESTSET: {
+        TValue *rb = base + GETARG_B(i);
+        taken = (l_isfalse(rb) != GETARG_C(i));
+        next = taken ? testjump(code, pc) : pc + 2;
+        if (next > loop) return REC_ABORT;
+        if (taken) setobjs2s(L, ra, rb);
+        break;
+      }
+      default: return REC_NYI;
+    }
+    if (next > loop) return REC_ABORT;  /* leaving the loop (`break') */
+    else if (next <= pc) return REC_NYI;  /* inner loop */
+    SET_OPCODE(i, op);
+    R->ins[R->n].i = i;
+    R->ins[R->n].pc = pc;
+    R->ins[R->n].taken = taken;
+    R->n++;
+    pc = next;
+  }
+  *stop = loop;
+  return REC_DONE;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** x86-64 code generator
+** =======================================================
+*/
+
+/* registers; the trace is called as `trace(base, k, cl)' */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RSI	6
+#define RDI	7
+#define RBASE	RDI
+#define RKST	RSI
+#define RCL	RDX
+
+/* condition codes of `jcc rel32' */
+#define CC_B	0x82
+#define CC_AE	0x83
+#define CC_E	0x84
+#define CC_NE	0x85
+#define CC_BE	0x86
+#define CC_A	0x87
+#define CC_P	0x8a
+#define CC_GE	0x8d
+
+/* opcodes (prefixes included) */
+#define XO_MOVSDld	0xf20f10
+#define XO_MOVSDst	0xf20f11
+#define XO_ADDSD	0xf20f58
+#define XO_MULSD	0xf20f59
+#define XO_SUBSD	0xf20f5c
+#define XO_DIVSD	0xf20f5e
+#define XO_CVTTSD2SI	0xf20f2c
+#define XO_CVTSI2SD	0xf20f2a
+#define XO_UCOMISD	0x660f2e
+#define XO_XORPD	0x660f57
+#define XO_MOVUPSld	0x0f10
+#define XO_MOVUPSst	0x0f11
+#define XO_MOVld	0x8b
+#define XO_MOVst	0x89
+#define XO_MOVQld	0x488b
+#define XO_MOVQst	0x4889
+#define XO_CMPld	0x3b
+#define XO_ARITHi8	0x83	/* /7 is `cmp' */
+#define XO_MOVi	0xc7
+
+#define TVSHIFT		4	/* log2(sizeof(TValue)) */
+#define PKSHIFT		3	/* log2(sizeof(PackedNum)) */
+#define TTOFS		cast_int(offsetof(TValue, tt))
+#define ROFS(r)		(cast_int(r) << TVSHIFT)
+#define rkbase(x)	(ISK(x) ? RKST : RBASE)
+#define rkofs(x)	ROFS(ISK(x) ? INDEXK(x) : (x))
+
+/* unknown type of a register */
+#define TUNKNOWN	(-2)
+
+
+static void e_byte (JitState *J, int b) {
+  if (J->nmc < MAXMCODE)
+    J->mcode[J->nmc++] = cast(unsigned char, b);
+  else J->fail = 1;
+}
+
+
+static void e_word (JitState *J, int w) {
+  e_byte(J, w & 0xff);
+  e_byte(J, (w >> 8) & 0xff);
+  e_byte(J, (w >> 16) & 0xff);
+  e_byte(J, (w >> 24) & 0xff);
+}
+
+
+static void e_opcode (JitState *J, int op) {
+  if (op > 0xffff) e_byte(J, op >> 16);
+  if (op > 0xff) e_byte(J, (op >> 8) & 0xff);
+  e_byte(J, op & 0xff);
+}
+
+
+/* instruction with register operand `r' and memory operand `[b+d]' */
+static void e_op (JitState *J, int op, int r, int b, int d) {
+  e_opcode(J, op);
+  e_byte(J, 0x80 | (r << 3) | b);  /* mod 10: base + disp32 */
+  e_word(J, d);
+}
+
+
+/* instruction with register operands */
+static void e_rr (JitState *J, int op, int r, int rm) {
+  e_opcode(J, op);
+  e_byte(J, 0xc0 | (r << 3) | rm);
+}
+
+
+/* conditional jump to a stub returning `pc' */
+static void e_exit (JitState *J, int cc, int pc) {
+  e_byte(J, 0x0f);
+  e_byte(J, cc);
+  if (J->nexits < MAXEXITS) {
+    J->exitat[J->nexits] = J->nmc;
+    J->exitpc[J->nexits++] = pc;
+  }
+  else J->fail = 1;
+  e_word(J, 0);
+}
+
+
+static void e_settype (JitState *J, int b, int d, int tt) {
+  e_op(J, XO_MOVi, 0, b, d + TTOFS);
+  e_word(J, tt);
+}
+
+
+/*
+** compiled code works on floats only: the `n' values at `[b+d]' are
+** converted in place when the first one is an integer
+*/
+static void e_toflt (JitState *J, int b, int d, int n) {
+  int skip;
+  e_op(J, XO_ARITHi8, 7, b, d + TTOFS); e_byte(J, LUA_TINT);
+  e_byte(J, 0x75); e_byte(J, 0);  /* jne done */
+  skip = J->nmc;
+  for (; n > 0; n--, d += ROFS(1)) {
+    e_byte(J, 0xf2); e_op(J, 0x480f2a, 7, b, d);  /* cvtsi2sd xmm7, [b+d] */
+    e_op(J, XO_MOVSDst, 7, b, d);
+    e_settype(J, b, d, LUA_TNUMBER);
+  }
+  if (!J->fail)
+    J->mcode[skip-1] = cast(unsigned char, J->nmc - skip);
+}
+
+
+/* `op' xmm(x), constant `o' */
+static void e_knum (JitState *J, int op, int x, const TValue *o, int b,
+                    int d) {
+  if (ttisint(o)) {
+    e_byte(J, 0xf2); e_op(J, 0x480f2a, 7, b, d);  /* cvtsi2sd xmm7, [b+d] */
+    e_rr(J, op, x, 7);
+  }
+  else e_op(J, op, x, b, d);
+}
+
+
+/* `op' xmm(x), RK(r) */
+static void e_rknum (JitState *J, int op, int x, const TValue *k, int r) {
+  if (ISK(r)) e_knum(J, op, x, k + INDEXK(r), RKST, ROFS(INDEXK(r)));
+  else e_op(J, op, x, RBASE, ROFS(r));
+}
+
+
+static void e_checktype (JitState *J, int *ktype, int r, int tt, int pc) {
+  if (ktype[r] != tt) {
+    if (tt == LUA_TNUMBER) e_toflt(J, RBASE, ROFS(r), 1);
+    e_op(J, XO_ARITHi8, 7, RBASE, ROFS(r) + TTOFS);
+    e_byte(J, tt);
+    e_exit(J, CC_NE, pc);
+    ktype[r] = tt;
+  }
+}
+
+
+/* RK operand known to be a number: constants were checked when recording */
+static void e_checknum (JitState *J, int *ktype, int x, int pc) {
+  if (!ISK(x))
+    e_checktype(J, ktype, x, LUA_TNUMBER, pc);
+}
+
+
+static void e_copy (JitState *J, int fromb, int fromd, int tob, int tod) {
+  e_op(J, XO_MOVUPSld, 0, fromb, fromd);
+  e_op(J, XO_MOVUPSst, 0, tob, tod);
+}
+
+
+/* eax = l_isfalse(register r), with `base' in register `rb' */
+static void e_isfalse (JitState *J, int rb, int r) {
+  e_op(J, XO_MOVld, RCX, rb, ROFS(r) + TTOFS);
+  e_rr(J, 0x31, RAX, RAX);  /* xor eax, eax */
+  e_rr(J, 0x85, RCX, RCX);  /* test ecx, ecx */
+  e_byte(J, 0x74); e_byte(J, 14);  /* je true */
+  e_rr(J, XO_ARITHi8, 7, RCX); e_byte(J, LUA_TBOOLEAN);
+  e_byte(J, 0x75); e_byte(J, 14);  /* jne done */
+  e_op(J, XO_ARITHi8, 7, rb, ROFS(r)); e_byte(J, 0);
+  e_byte(J, 0x75); e_byte(J, 5);  /* jne done */
+  e_byte(J, 0xb8); e_word(J, 1);  /* true: mov eax, 1 */
+  /* done: */
+}
+
+
+/*
+** rax = address of the (non-nil) array slot `t[key]'; when `packed',
+** the array part must be packed, and rax is the address of the PackedNum
+*/
+static void e_arrayslot (JitState *J, const TValue *k, int *ktype, int t,
+                         int key, int packed, int pc) {
+  e_checktype(J, ktype, t, LUA_TTABLE, pc);
+  e_checknum(J, ktype, key, pc);
+  e_op(J, XO_MOVQld, RAX, RBASE, ROFS(t));
+  e_rknum(J, XO_MOVSDld, 0, k, key);
+  e_rr(J, XO_CVTTSD2SI, RCX, 0);
+  e_rr(J, XO_CVTSI2SD, 1, RCX);
+  e_rr(J, XO_UCOMISD, 0, 1);  /* key must be an integer */
+  e_exit(J, CC_NE, pc);
+  e_exit(J, CC_P, pc);
+  e_rr(J, 0xff, 1, RCX);  /* dec ecx */
+  e_op(J, XO_CMPld, RCX, RAX, cast_int(offsetof(Table, sizearray)));
+  e_exit(J, CC_AE, pc);
+#if defined(LUA_USE_PACKED)
+  e_op(J, 0x80, 7, RAX, cast_int(offsetof(Table, packed)));  /* cmp byte */
+  e_byte(J, packed);
+  e_exit(J, CC_NE, pc);
+  if (packed) {
+    e_op(J, XO_MOVQld, RAX, RAX, cast_int(offsetof(Table, array)));
+    e_rr(J, 0x48c1, 4, RCX); e_byte(J, PKSHIFT);  /* shl rcx, PKSHIFT */
+    e_rr(J, 0x4801, RCX, RAX);  /* add rax, rcx */
+    e_byte(J, 0x48); e_byte(J, 0xb9);  /* mov rcx, PK_NIL */
+    e_word(J, cast_int(PK_NIL & 0xffffffffUL));
+    e_word(J, cast_int(PK_NIL >> 32));
+    e_op(J, XO_CMPld | 0x4800, RCX, RAX, 0);
+    e_exit(J, CC_E, pc);
+    return;
+  }
+#else
+  UNUSED(packed);
+#endif
+  e_op(J, XO_MOVQld, RAX, RAX, cast_int(offsetof(Table, array)));
+  e_rr(J, 0x48c1, 4, RCX); e_byte(J, TVSHIFT);  /* shl rcx, TVSHIFT */
+  e_rr(J, 0x4801, RCX, RAX);  /* add rax, rcx */
+  e_op(J, XO_ARITHi8, 7, RAX, TTOFS); e_byte(J, LUA_TNIL);
+  e_exit(J, CC_E, pc);
+}
+
+
+static void e_ins (JitState *J, const TValue *k, int *ktype,
+                   const TraceIns *T) {
+  Instruction i = T->i;
+  int pc = T->pc;
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      e_copy(J, RBASE, ROFS(b), RBASE, ROFS(a));
+      ktype[a] = ktype[b];
+      break;
+    }
+    case OP_LOADK: {
+      const TValue *o = k + GETARG_Bx(i);
+      if (ttisint(o)) {
+        e_knum(J, XO_MOVSDld, 0, o, RKST, ROFS(GETARG_Bx(i)));
+        e_op(J, XO_MOVSDst, 0, RBASE, ROFS(a));
+        if (ktype[a] != LUA_TNUMBER)
+          e_settype(J, RBASE, ROFS(a), LUA_TNUMBER);
+      }
+      else e_copy(J, RKST, ROFS(GETARG_Bx(i)), RBASE, ROFS(a));
+      ktype[a] = ttype(o);
+      break;
+    }
+    case OP_LOADBOOL: {
+      e_op(J, XO_MOVi, 0, RBASE, ROFS(a));
+      e_word(J, b);
+      e_settype(J, RBASE, ROFS(a), LUA_TBOOLEAN);
+      ktype[a] = LUA_TBOOLEAN;
+      break;
+    }
+    case OP_LOADNIL: {
+      for (; a <= b; a++) {
+        e_settype(J, RBASE, ROFS(a), LUA_TNIL);
+        ktype[a] = LUA_TNIL;
+      }
+      break;
+    }
+    case OP_GETUPVAL: {
+      e_op(J, XO_MOVQld, RAX, RCL,
+           cast_int(offsetof(LClosure, upvals) + b*sizeof(UpVal *)));
+      e_op(J, XO_MOVQld, RAX, RAX, cast_int(offsetof(UpVal, v)));
+      e_copy(J, RAX, 0, RBASE, ROFS(a));
+      ktype[a] = TUNKNOWN;
+      break;
+    }
+    case OP_GETTABLE: {
+      e_arrayslot(J, k, ktype, b, c, T->taken, pc);
+      if (T->taken) {  /* packed array part */
+        e_op(J, XO_MOVSDld, 0, RAX, 0);
+        e_op(J, XO_MOVSDst, 0, RBASE, ROFS(a));
+        if (ktype[a] != LUA_TNUMBER)
+          e_settype(J, RBASE, ROFS(a), LUA_TNUMBER);
+        ktype[a] = LUA_TNUMBER;
+        break;
+      }
+      e_copy(J, RAX, 0, RBASE, ROFS(a));
+      ktype[a] = TUNKNOWN;
+      break;
+    }
+    case OP_SETTABLE: {
+      if (T->taken) {  /* packed array part: stores a number, but no NaN */
+        e_checknum(J, ktype, c, pc);
+        e_arrayslot(J, k, ktype, a, b, 1, pc);
+        e_rknum(J, XO_MOVSDld, 0, k, c);
+        e_rr(J, XO_UCOMISD, 0, 0);
+        e_exit(J, CC_P, pc);
+        e_op(J, XO_MOVSDst, 0, RAX, 0);
+        break;
+      }
+      if (!ISK(c) && (ktype[c] == TUNKNOWN || ktype[c] >= LUA_TSTRING)) {
+        /* no write barrier: only non-collectable values are stored */
+        e_toflt(J, RBASE, ROFS(c), 1);
+        e_op(J, XO_ARITHi8, 7, RBASE, ROFS(c) + TTOFS);
+        e_byte(J, LUA_TSTRING);
+        e_exit(J, CC_GE, pc);
+      }
+      e_arrayslot(J, k, ktype, a, b, 0, pc);
+      e_copy(J, rkbase(c), rkofs(c), RAX, 0);
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: {
+      static const int xo[] = {XO_ADDSD, XO_SUBSD, XO_MULSD, XO_DIVSD};
+      e_checknum(J, ktype, b, pc);
+      e_checknum(J, ktype, c, pc);
+      e_rknum(J, XO_MOVSDld, 0, k, b);
+      e_rknum(J, xo[GET_OPCODE(i) - OP_ADD], 0, k, c);
+      e_op(J, XO_MOVSDst, 0, RBASE, ROFS(a));
+      if (ktype[a] != LUA_TNUMBER)
+        e_settype(J, RBASE, ROFS(a), LUA_TNUMBER);
+      ktype[a] = LUA_TNUMBER;
+      break;
+    }
+    case OP_UNM: {
+      e_checknum(J, ktype, b, pc);
+      e_op(J, XO_MOVQld, RAX, RBASE, ROFS(b));
+      e_rr(J, 0x480fba, 7, RAX); e_byte(J, 63);  /* btc rax, 63 */
+      e_op(J, XO_MOVQst, RAX, RBASE, ROFS(a));
+      if (ktype[a] != LUA_TNUMBER)
+        e_settype(J, RBASE, ROFS(a), LUA_TNUMBER);
+      ktype[a] = LUA_TNUMBER;
+      break;
+    }
+    case OP_NOT: {
+      e_isfalse(J, RBASE, b);
+      e_op(J, XO_MOVst, RAX, RBASE, ROFS(a));
+      e_settype(J, RBASE, ROFS(a), LUA_TBOOLEAN);
+      ktype[a] = LUA_TBOOLEAN;
+      break;
+    }
+    case OP_JMP: break;
+    case OP_EQ: case OP_LT: case OP_LE: {
+      int res = T->taken ? a : !a;  /* expected result of the comparison */
+      e_checknum(J, ktype, b, pc);
+      e_checknum(J, ktype, c, pc);
+      e_rknum(J, XO_MOVSDld, 0, k, b);
+      e_rknum(J, XO_MOVSDld, 1, k, c);
+      if (GET_OPCODE(i) == OP_EQ) {
+        e_rr(J, XO_UCOMISD, 0, 1);
+        if (res) {
+          e_exit(J, CC_NE, pc);
+          e_exit(J, CC_P, pc);
+        }
+        else {
+          e_byte(J, 0x7a); e_byte(J, 6);  /* jp (unordered: not equal) */
+          e_exit(J, CC_E, pc);
+        }
+      }
+      else {
+        e_rr(J, XO_UCOMISD, 1, 0);  /* compare c with b */
+        if (GET_OPCODE(i) == OP_LT)
+          e_exit(J, res ? CC_BE : CC_A, pc);
+        else
+          e_exit(J, res ? CC_B : CC_AE, pc);
+      }
+      break;
+    }
+    case OP_TEST: case OP_TESTSET: {
+      int r = (GET_OPCODE(i) == OP_TEST) ? a : b;
+      if (ktype[r] == TUNKNOWN || ktype[r] <= LUA_TBOOLEAN) {
+        e_isfalse(J, RBASE, r);
+        e_rr(J, XO_ARITHi8, 7, RAX);
+        e_byte(J, T->taken ? !c : c);
+        e_exit(J, CC_NE, pc);
+      }
+      if (GET_OPCODE(i) == OP_TESTSET && T->taken) {
+        e_copy(J, RBASE, ROFS(b), RBASE, ROFS(a));
+        ktype[a] = ktype[b];
+      }
+      break;
+    }
+    default: lua_assert(0);
+  }
+}
+
+
+static int compile (JitState *J, Proto *p, const RecState *R, int head,
+                    int loop) {
+  int ktype[MAXSTACK];
+  int a = GETARG_A(p->code[loop]);
+  int start, n, r;
+  J->nmc = J->nexits = J->fail = 0;
+  e_toflt(J, RBASE, ROFS(a), 4);
+  /* entry: check that the step has the recorded sign */
+  e_op(J, XO_MOVSDld, 0, RBASE, ROFS(a+2));
+  e_rr(J, XO_XORPD, 1, 1);
+  e_rr(J, XO_UCOMISD, 0, 1);
+  e_exit(J, R->up ? CC_BE : CC_A, head);
+  /* loop body */
+  start = J->nmc;
+  for (r = 0; r < p->maxstacksize; r++) ktype[r] = TUNKNOWN;
+  for (r = a; r <= a+3; r++) ktype[r] = LUA_TNUMBER;
+  for (n = 0; n < R->n; n++)
+    e_ins(J, p->k, ktype, &R->ins[n]);
+  /* OP_FORLOOP */
+  e_op(J, XO_MOVSDld, 0, RBASE, ROFS(a));
+  e_op(J, XO_ADDSD, 0, RBASE, ROFS(a+2));
+  e_op(J, XO_MOVSDld, 1, RBASE, ROFS(a+1));
+  if (R->up) e_rr(J, XO_UCOMISD, 1, 0);
+  else e_rr(J, XO_UCOMISD, 0, 1);
+  e_exit(J, CC_B, loop + 1);
+  e_op(J, XO_MOVSDst, 0, RBASE, ROFS(a));
+  e_op(J, XO_MOVSDst, 0, RBASE, ROFS(a+3));
+  if (ktype[a+3] != LUA_TNUMBER)
+    e_settype(J, RBASE, ROFS(a+3), LUA_TNUMBER);
+  e_byte(J, 0xe9);  /* jmp start */
+  e_word(J, start - (J->nmc + 4));
+  /* exit stubs: `mov eax, pc; ret' */
+  for (n = 0; n < J->nexits && !J->fail; n++) {
+    int at = J->exitat[n];
+    int rel = J->nmc - (at + 4);
+    J->mcode[at] = cast(unsigned char, rel & 0xff);
+    J->mcode[at+1] = cast(unsigned char, (rel >> 8) & 0xff);
+    J->mcode[at+2] = cast(unsigned char, (rel >> 16) & 0xff);
+    J->mcode[at+3] = cast(unsigned char, (rel >> 24) & 0xff);
+    e_byte(J, 0xb8);
+    e_word(J, J->exitpc[n]);
+    e_byte(J, 0xc3);
+  }
+  return !J->fail;
+}
+
+/* }====================================================== */
+
+
+
+typedef int (*TraceFunc) (TValue *base, const TValue *k, LClosure *cl);
+
+typedef int (*MethodFunc) (lua_State *L, const void *entry);
+
+typedef union MCode {
+  void *p;
+  TraceFunc f;
+  MethodFunc m;
+} MCode;
+
+
+static void *mcode_new (JitState *J, size_t *sz) {
+  void *p;
+  *sz = cast(size_t, J->nmc);
+  p = mmap(NULL, *sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  memcpy(p, J->mcode, *sz);
+  if (mprotect(p, *sz, PROT_READ|PROT_EXEC) != 0) {
+    munmap(p, *sz);
+    return NULL;
+  }
+  return p;
+}
+
+
+static void freetraces (JitState *J) {
+  int n;
+  for (n = 0; n < J->ntraces; n++)
+    munmap(J->traces[n].mcode, J->traces[n].szmcode);
+  J->ntraces = 0;
+}
+
+
+/*
+** {======================================================
+** Compiler of whole functions
+** =======================================================
+*/
+
+/* registers of compiled functions (callee-saved) */
+#define ML	3	/* rbx: lua_State */
+#define MBASE	5	/* rbp: L->base, reloaded after each helper call */
+
+/* code of `OP_MOVE' in `e_rr' form for 64-bit registers */
+#define XO_MOVQrr	0x4889
+
+
+static void e_imm64 (JitState *J, size_t v) {
+  e_word(J, cast_int(v & 0xffffffff));
+  e_word(J, cast_int((v >> 16) >> 16));
+}
+
+
+/* mov r, imm64 */
+static void m_loadaddr (JitState *J, int r, size_t v) {
+  e_byte(J, 0x48);
+  e_byte(J, 0xb8 + r);
+  e_imm64(J, v);
+}
+
+
+/* jump (cc == 0) or conditional jump to instruction `target' */
+static void m_jump (JitState *J, int cc, int target) {
+  if (cc == 0) e_byte(J, 0xe9);
+  else { e_byte(J, 0x0f); e_byte(J, cc); }
+  e_word(J, J->ofs[target] - (J->nmc + 4));
+}
+
+
+/* forward jump to a label inside the current instruction */
+static int m_jfwd (JitState *J, int cc) {
+  int at;
+  if (cc == 0) e_byte(J, 0xe9);
+  else { e_byte(J, 0x0f); e_byte(J, cc); }
+  at = J->nmc;
+  e_word(J, 0);
+  return at;
+}
+
+
+static void m_here (JitState *J, int at) {
+  int rel = J->nmc - (at + 4);
+  if (J->fail) return;
+  J->mcode[at] = cast(unsigned char, rel & 0xff);
+  J->mcode[at+1] = cast(unsigned char, (rel >> 8) & 0xff);
+  J->mcode[at+2] = cast(unsigned char, (rel >> 16) & 0xff);
+  J->mcode[at+3] = cast(unsigned char, (rel >> 24) & 0xff);
+}
+
+
+/* leave the compiled code, resuming the interpreter at `pc' */
+static void m_exit (JitState *J, int pc) {
+  e_byte(J, 0xb8);  /* mov eax, pc */
+  e_word(J, pc);
+  e_byte(J, 0xe9);  /* jmp epilogue (at offset 0) */
+  e_word(J, -(J->nmc + 4));
+}
+
+
+static void m_call (JitState *J, JHelper f, const Instruction *pc) {
+  e_rr(J, XO_MOVQrr, ML, RDI);
+  m_loadaddr(J, RSI, cast(size_t, pc));
+  m_loadaddr(J, RAX, cast(size_t, f));
+  e_rr(J, 0xff, 2, RAX);  /* call rax */
+  e_op(J, XO_MOVQld, MBASE, ML, cast_int(offsetof(lua_State, base)));
+}
+
+
+/* `op' xmm(x), RK(r) */
+static void m_rknum (JitState *J, int op, int x, const TValue *k, int r) {
+  if (ISK(r)) {
+    m_loadaddr(J, RAX, cast(size_t, k + INDEXK(r)));
+    e_knum(J, op, x, k + INDEXK(r), RAX, 0);
+  }
+  else e_op(J, op, x, MBASE, ROFS(r));
+}
+
+
+/*
+** type checks of the inlined number case of an instruction; they jump
+** to its generic case, whose positions are left in `slow'. Returns 0 if
+** an operand is a constant that is not a number.
+*/
+static int m_isnum (JitState *J, const TValue *k, int r, int *slow,
+                    int *nslow) {
+  if (ISK(r)) return ttisnumber(k + INDEXK(r));
+  e_toflt(J, MBASE, ROFS(r), 1);
+  e_op(J, XO_ARITHi8, 7, MBASE, ROFS(r) + TTOFS);
+  e_byte(J, LUA_TNUMBER);
+  slow[(*nslow)++] = m_jfwd(J, CC_NE);
+  return 1;
+}
+
+
+/* compile instruction `n'; returns the next instruction to compile */
+static int m_ins (JitState *J, Proto *p, int n) {
+  const Instruction *pc = p->code + n;
+  const TValue *k = p->k;
+  Instruction i = *pc;
+  OpCode op = luaP_opbase[GET_OPCODE(i)];
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  int next = n + 1;
+  J->ofs[n] = J->nmc;
+  switch (op) {
+    case OP_MOVE: {
+      e_copy(J, MBASE, ROFS(b), MBASE, ROFS(a));
+      break;
+    }
+    case OP_LOADK: {
+      m_loadaddr(J, RAX, cast(size_t, k + GETARG_Bx(i)));
+      e_copy(J, RAX, 0, MBASE, ROFS(a));
+      break;
+    }
+    case OP_LOADBOOL: {
+      e_op(J, XO_MOVi, 0, MBASE, ROFS(a));
+      e_word(J, b);
+      e_settype(J, MBASE, ROFS(a), LUA_TBOOLEAN);
+      if (c) m_jump(J, 0, n + 2);
+      break;
+    }
+    case OP_LOADNIL: {
+      for (; a <= b; a++)
+        e_settype(J, MBASE, ROFS(a), LUA_TNIL);
+      break;
+    }
+    case OP_GETUPVAL: m_call(J, h_getupval, pc); break;
+    case OP_GETGLOBAL: m_call(J, h_getglobal, pc); break;
+    case OP_GETTABLE: m_call(J, h_gettable, pc); break;
+    case OP_SETGLOBAL: m_call(J, h_setglobal, pc); break;
+    case OP_SETUPVAL: m_call(J, h_setupval, pc); break;
+    case OP_SETTABLE: m_call(J, h_settable, pc); break;
+    case OP_NEWTABLE: m_call(J, h_newtable, pc); break;
+    case OP_SELF: m_call(J, h_self, pc); break;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: {
+      static const int xo[] = {XO_ADDSD, XO_SUBSD, XO_MULSD, XO_DIVSD};
+      int slow[2], nslow = 0, done;
+      if (m_isnum(J, k, b, slow, &nslow) && m_isnum(J, k, c, slow, &nslow)) {
+        m_rknum(J, XO_MOVSDld, 0, k, b);
+        m_rknum(J, xo[op - OP_ADD], 0, k, c);
+        e_op(J, XO_MOVSDst, 0, MBASE, ROFS(a));
+        e_settype(J, MBASE, ROFS(a), LUA_TNUMBER);
+        done = m_jfwd(J, 0);
+        while (nslow) m_here(J, slow[--nslow]);
+        m_call(J, h_arith, pc);
+        m_here(J, done);
+      }
+      else {
+        while (nslow) m_here(J, slow[--nslow]);
+        m_call(J, h_arith, pc);
+      }
+      break;
+    }
+    case OP_MOD: case OP_POW: case OP_UNM: m_call(J, h_arith, pc); break;
+    case OP_NOT: {
+      e_isfalse(J, MBASE, b);
+      e_op(J, XO_MOVst, RAX, MBASE, ROFS(a));
+      e_settype(J, MBASE, ROFS(a), LUA_TBOOLEAN);
+      break;
+    }
+    case OP_LEN: m_call(J, h_len, pc); break;
+    case OP_CONCAT: m_call(J, h_concat, pc); break;
+    case OP_JMP: {
+      m_jump(J, 0, n + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: {
+      /* jump over the following OP_JMP when the test fails */
+      int target = n + 2 + GETARG_sBx(pc[1]);
+      int slow[2], nslow = 0;
+      if (m_isnum(J, k, b, slow, &nslow) && m_isnum(J, k, c, slow, &nslow)) {
+        m_rknum(J, XO_MOVSDld, 0, k, b);
+        m_rknum(J, XO_MOVSDld, 1, k, c);
+        if (op == OP_EQ) {
+          e_rr(J, XO_UCOMISD, 0, 1);
+          if (a) {
+            m_jump(J, CC_P, n + 2);
+            m_jump(J, CC_E, target);
+          }
+          else {
+            m_jump(J, CC_P, target);
+            m_jump(J, CC_NE, target);
+          }
+        }
+        else {
+          e_rr(J, XO_UCOMISD, 1, 0);  /* compare c with b */
+          if (op == OP_LT) m_jump(J, a ? CC_A : CC_BE, target);
+          else m_jump(J, a ? CC_AE : CC_B, target);
+        }
+        m_jump(J, 0, n + 2);
+      }
+      while (nslow) m_here(J, slow[--nslow]);
+      m_call(J, op == OP_EQ ? h_eq : op == OP_LT ? h_lt : h_le, pc);
+      e_rr(J, 0x85, RAX, RAX);  /* test eax, eax */
+      m_jump(J, CC_NE, target);
+      m_jump(J, 0, n + 2);
+      next = n + 2;
+      J->ofs[n + 1] = J->nmc;  /* never entered */
+      break;
+    }
+    case OP_TEST: case OP_TESTSET: {
+      int target = n + 2 + GETARG_sBx(pc[1]);
+      e_isfalse(J, MBASE, op == OP_TEST ? a : b);
+      e_rr(J, XO_ARITHi8, 7, RAX); e_byte(J, c);  /* cmp eax, c */
+      if (op == OP_TEST)
+        m_jump(J, CC_NE, target);
+      else {
+        m_jump(J, CC_E, n + 2);
+        e_copy(J, MBASE, ROFS(b), MBASE, ROFS(a));
+        m_jump(J, 0, target);
+      }
+      m_jump(J, 0, n + 2);
+      next = n + 2;
+      J->ofs[n + 1] = J->nmc;
+      break;
+    }
+    case OP_CALL: case OP_TAILCALL: case OP_RETURN: {
+      m_exit(J, n);
+      break;
+    }
+    case OP_FORLOOP: {
+      int down, exit1, exit2, store;
+      e_toflt(J, MBASE, ROFS(a), 3);
+      e_op(J, XO_MOVSDld, 0, MBASE, ROFS(a));
+      e_op(J, XO_ADDSD, 0, MBASE, ROFS(a+2));
+      e_op(J, XO_MOVSDld, 1, MBASE, ROFS(a+1));
+      e_op(J, XO_MOVSDld, 2, MBASE, ROFS(a+2));
+      e_rr(J, XO_XORPD, 3, 3);
+      e_rr(J, XO_UCOMISD, 2, 3);
+      down = m_jfwd(J, CC_BE);  /* step <= 0? */
+      e_rr(J, XO_UCOMISD, 1, 0);
+      exit1 = m_jfwd(J, CC_B);  /* limit < idx? */
+      store = m_jfwd(J, 0);
+      m_here(J, down);
+      e_rr(J, XO_UCOMISD, 0, 1);
+      exit2 = m_jfwd(J, CC_B);  /* idx < limit? */
+      m_here(J, store);
+      e_op(J, XO_MOVSDst, 0, MBASE, ROFS(a));
+      e_op(J, XO_MOVSDst, 0, MBASE, ROFS(a+3));
+      e_settype(J, MBASE, ROFS(a+3), LUA_TNUMBER);
+      m_jump(J, 0, n + 1 + GETARG_sBx(i));
+      m_here(J, exit1);
+      m_here(J, exit2);
+      break;
+    }
+    case OP_FORPREP: {
+      m_call(J, h_forprep, pc);
+      m_jump(J, 0, n + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_TFORLOOP: {
+      m_call(J, h_tforloop, pc);
+      e_rr(J, 0x85, RAX, RAX);
+      m_jump(J, CC_NE, n + 2 + GETARG_sBx(pc[1]));
+      m_jump(J, 0, n + 2);
+      next = n + 2;
+      J->ofs[n + 1] = J->nmc;
+      break;
+    }
+    case OP_SETLIST: {
+      m_call(J, h_setlist, pc);
+      if (c == 0) {  /* skip the extra argument */
+        J->ofs[n + 1] = J->nmc;
+        next++;
+      }
+      break;
+    }
+    case OP_CLOSE: m_call(J, h_close, pc); break;
+    case OP_CLOSURE: {
+      int nup = p->p[GETARG_Bx(i)]->nups;
+      m_call(J, h_closure, pc);
+      for (; nup > 0; nup--) {  /* skip the upvalue pseudo-instructions */
+        J->ofs[next] = J->nmc;
+        next++;
+      }
+      break;
+    }
+    case OP_VARARG: m_call(J, h_vararg, pc); break;
+    default: lua_assert(0);
+  }
+  return next;
+}
+
+
+static JitCode *compilefunc (lua_State *L, JitState *J, Proto *p) {
+  JitCode *jc = cast(JitCode *, luaM_malloc(L, sizejitcode(p->sizecode)));
+  int pass, n;
+  for (n = 0; n < p->sizecode; n++) jc->ofs[n] = 0;
+  J->ofs = jc->ofs;
+  /* first pass finds the offsets of all instructions for the second */
+  for (pass = 0; pass < 2; pass++) {
+    J->nmc = J->fail = 0;
+    /* epilogue, at offset 0 */
+    e_byte(J, 0x48); e_byte(J, 0x83); e_byte(J, 0xc4); e_byte(J, 8);
+    e_byte(J, 0x5d);  /* pop rbp */
+    e_byte(J, 0x5b);  /* pop rbx */
+    e_byte(J, 0xc3);  /* ret */
+    /* entry point: `f(L, code to start at)' */
+    jc->entry = J->nmc;
+    e_byte(J, 0x53);  /* push rbx */
+    e_byte(J, 0x55);  /* push rbp */
+    e_byte(J, 0x48); e_byte(J, 0x83); e_byte(J, 0xec); e_byte(J, 8);
+    e_rr(J, XO_MOVQrr, RDI, ML);
+    e_op(J, XO_MOVQld, MBASE, ML, cast_int(offsetof(lua_State, base)));
+    e_rr(J, 0xff, 4, RSI);  /* jmp rsi */
+    for (n = 0; n < p->sizecode && !J->fail; )
+      n = m_ins(J, p, n);
+    if (J->fail) break;
+  }
+  if (J->fail || (jc->mcode = mcode_new(J, &jc->szmcode)) == NULL) {
+    luaM_freemem(L, jc, sizejitcode(p->sizecode));
+    return NULL;
+  }
+  J->nfuncs++;
+  return jc;
+}
+
+/* }====================================================== */
+
+
+/* record and compile the loop whose slot became hot; returns resume pc */
+static int trace (lua_State *L, JitState *J, LClosure *cl, int head,
+                  int loop, int *slot) {
+  Proto *p = cl->p;
+  RecState R;
+  int stop;
+  int res;
+  R.up = luai_numlt(0, nvalue(L->base + GETARG_A(p->code[loop]) + 2));
+  res = record(L, cl, &R, head, loop, &stop);
+  if (res == REC_ABORT)
+    *slot = 0;  /* try again later */
+  else if (res == REC_NYI || J->ntraces >= MAXTRACES ||
+           !compile(J, p, &R, head, loop))
+    *slot = BLACKLISTED;
+  else {
+    Trace *tr;
+    void *mc;
+    size_t sz;
+    luaM_growvector(L, J->traces, J->ntraces, J->sizetraces, Trace,
+                    MAXTRACES, "traces");
+    mc = mcode_new(J, &sz);
+    if (mc == NULL)
+      *slot = BLACKLISTED;
+    else {
+      tr = &J->traces[J->ntraces];
+      tr->p = p;
+      tr->loop = loop;
+      tr->mcode = mc;
+      tr->szmcode = sz;
+      *slot = trace2slot(J->ntraces++);
+    }
+  }
+  return stop;
+}
+
+
+const Instruction *luaJ_loop (lua_State *L, LClosure *cl,
+                              const Instruction *pc, int *slot) {
+  JitState *J = G(L)->jit;
+  Proto *p = cl->p;
+  int loop = cast_int(slot - p->cache);
+  int s = *slot;
+  if (s >= 0) {  /* counting iterations? */
+    if (++s < HOTLOOP) *slot = s;
+    else pc = p->code + trace(L, J, cl, cast_int(pc - p->code), loop, slot);
+  }
+  else if (s != BLACKLISTED) {
+    int t = slot2trace(s);
+    if (t < J->ntraces && J->traces[t].p == p && J->traces[t].loop == loop) {
+      MCode mc;
+      mc.p = J->traces[t].mcode;
+      pc = p->code + (*mc.f)(L->base, p->k, cl);
+    }
+    else *slot = 0;  /* trace was flushed */
+  }
+  return pc;
+}
+
+
+const Instruction *luaJ_call (lua_State *L, LClosure *cl,
+                              const Instruction *pc) {
+  Proto *p = cl->p;
+  JitCode *jc = p->jitcode;
+  if (jc == NULL) {  /* not compiled yet? */
+    if (pc != p->code || p->ncalls < 0 || ++p->ncalls < HOTCALL)
+      return pc;
+    jc = compilefunc(L, G(L)->jit, p);
+    if (jc == NULL) {
+      p->ncalls = -1;  /* do not try again */
+      return pc;
+    }
+    p->jitcode = jc;
+  }
+  {
+    MCode mc;
+    mc.p = cast(char *, jc->mcode) + jc->entry;
+    return p->code + (*mc.m)(L, cast(char *, jc->mcode) +
+                                jc->ofs[pc - p->code]);
+  }
+}
+
+
+void luaJ_freecode (lua_State *L, Proto *p) {
+  JitCode *jc = p->jitcode;
+  if (jc != NULL) {
+    munmap(jc->mcode, jc->szmcode);
+    luaM_freemem(L, jc, sizejitcode(p->sizecode));
+    p->jitcode = NULL;
+  }
+}
+
+
+int luaJ_on (lua_State *L) {
+  global_State *g = G(L);
+  if (sizeof(TValue) != (1u << TVSHIFT) || offsetof(TValue, value) != 0)
+    return 0;  /* value layout not handled by the code generator */
+  if (g->jit == NULL) {
+    JitState *J = luaM_new(L, JitState);
+    J->traces = NULL;
+    J->ntraces = J->sizetraces = J->nfuncs = 0;
+    g->jit = J;
+  }
+  return 1;
+}
+
+
+void luaJ_off (lua_State *L) {
+  global_State *g = G(L);
+  JitState *J = g->jit;
+  if (J != NULL) {
+    freetraces(J);
+    luaM_freearray(L, J->traces, J->sizetraces, Trace);
+    luaM_free(L, J);
+    g->jit = NULL;
+  }
+}
+
+
+void luaJ_flush (lua_State *L) {
+  if (G(L)->jit != NULL)
+    freetraces(G(L)->jit);
+}
+
+
+int luaJ_count (lua_State *L, int funcs) {
+  JitState *J = G(L)->jit;
+  if (J == NULL) return 0;
+  return funcs ? J->nfuncs : J->ntraces;
+}
+
+
+#else
+
+
+int luaJ_on (lua_State *L) {
+  UNUSED(L);
+  return 0;
+}
+
+
+void luaJ_off (lua_State *L) {
+  UNUSED(L);
+}
+
+
+void luaJ_flush (lua_State *L) {
+  UNUSED(L);
+}
+
+
+int luaJ_count (lua_State *L, int funcs) {
+  UNUSED(L); UNUSED(funcs);
+  return 0;
+}
+
+
+const Instruction *luaJ_loop (lua_State *L, LClosure *cl,
+                              const Instruction *pc, int *slot) {
+  UNUSED(L); UNUSED(cl); UNUSED(slot);
+  return pc;
+}
+
+
+const Instruction *luaJ_call (lua_State *L, LClosure *cl,
+                              const Instruction *pc) {
+  UNUSED(L); UNUSED(cl);
+  return pc;
+}
+
+
+void luaJ_freecode (lua_State *L, Proto *p) {
+  UNUSED(L); UNUSED(p);
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+** $Id: ljit.h $
+** Compilation of Lua code to machine code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+
+
+/* number of iterations before a loop is recorded */
+#define HOTLOOP		56
+
+/* number of calls before a function is compiled */
+#define HOTCALL		100
+
+
+LUAI_FUNC int luaJ_on (lua_State *L);
+LUAI_FUNC void luaJ_off (lua_State *L);
+LUAI_FUNC void luaJ_flush (lua_State *L);
+LUAI_FUNC int luaJ_count (lua_State *L, int funcs);
+LUAI_FUNC const Instruction *luaJ_loop (lua_State *L, LClosure *cl,
+                                        const Instruction *pc, int *slot);
+LUAI_FUNC const Instruction *luaJ_call (lua_State *L, LClosure *cl,
+                                        const Instruction *pc);
+LUAI_FUNC void luaJ_freecode (lua_State *L, Proto *p);
+LUAI_FUNC int luaJ_execop (lua_State *L, const Instruction *pc);
+
+
+/*
+** Code compiled ahead of time (see `luac -C'). The generated modules
+** include this header; these functions are exported for them only and
+** are not part of the API in lua.h.
+*/
+
+#if defined(LUA_NANBOX)
+#define LUAI_NATIVENANBOX	1
+#else
+#define LUAI_NATIVENANBOX	0
+#endif
+
+#if defined(LUA_USE_PACKED)
+#define LUAI_NATIVEPACKED	2
+#else
+#define LUAI_NATIVEPACKED	0
+#endif
+
+#if defined(LUA_OPENHASH)
+#define LUAI_NATIVEOPENHASH	4
+#else
+#define LUAI_NATIVEOPENHASH	0
+#endif
+
+/*
+** layout of values and tables that compiled code depends on; a module
+** passes the value its own options give, and is refused if it differs
+** from the interpreter's
+*/
+#define LUAI_NATIVECONF \
+	((int)(sizeof(TValue) << 8 | sizeof(lua_Number) << 4 | \
+	       LUAI_NATIVENANBOX | LUAI_NATIVEPACKED | LUAI_NATIVEOPENHASH))
+
+LUA_API int (lua_setnative) (lua_State *L, int idx, const lua_Native *f,
+                             int n, int conf);
+LUA_API int (lua_execop) (lua_State *L, int pc);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+** $Id: ljitlib.c $
+** Interface to the trace compiler
+** See Copyright Notice in lua.h
+*/
+
+
+#define ljitlib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+
+static int jit_on (lua_State *L) {
+  if (lua_jit(L, LUA_JITON)) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  lua_pushnil(L);
+  lua_pushliteral(L, "no trace compiler for this platform");
+  return 2;
+}
+
+
+static int jit_off (lua_State *L) {
+  lua_jit(L, LUA_JITOFF);
+  return 0;
+}
+
+
+static int jit_flush (lua_State *L) {
+  lua_jit(L, LUA_JITFLUSH);
+  return 0;
+}
+
+
+static int jit_status (lua_State *L) {
+  lua_pushboolean(L, lua_jit(L, LUA_JITSTATUS));
+  lua_pushinteger(L, lua_jit(L, LUA_JITCOUNT));
+  lua_pushinteger(L, lua_jit(L, LUA_JITFUNCS));
+  return 3;
+}
+
+
+static const luaL_Reg jitlib[] = {
+  {"flush", jit_flush},
+  {"off", jit_off},
+  {"on", jit_on},
+  {"status", jit_status},
+  {NULL, NULL}
+};
+
+
+LUALIB_API int luaopen_jit (lua_State *L) {
+  luaL_register(L, LUA_JITLIBNAME, jitlib);
+  return 1;
+}
+
@@ -24,7 +24,7 @@
 
 
 
-const TValue luaO_nilobject_ = {{NULL}, LUA_TNIL};
+const TValue luaO_nilobject_ = {NILCONSTANT};
 
 
 /*
@@ -87,6 +87,24 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
 }
 
 
+/*
+** converts `n' to an integer if it is one that a LUA_TINT value can hold:
+** integral, within LUAI_MAXINT and not -0
+*/
+int luaO_toint (lua_Number n, lua_Integer *i) {
+  lua_Integer k;
+  if (!(luai_numle(-cast_num(LUAI_MAXINT), n) &&
+        luai_numle(n, cast_num(LUAI_MAXINT))))
+    return 0;  /* too large, or NaN */
+  lua_number2integer(k, n);
+  if (!luai_numeq(cast_num(k), n) ||
+      (k == 0 && luai_numlt(luai_numdiv(1, n), 0)))
+    return 0;  /* not integral, or -0 */
+  *i = k;
+  return 1;
+}
+
+
 int luaO_str2d (const char *s, lua_Number *result) {
   char *endptr;
   *result = lua_str2number(s, &endptr);
@@ -30,6 +30,17 @@ values (TValue objects) in Lua.*/
 #define LUA_TPROTO	(LAST_TAG+1)
 #define LUA_TUPVAL	(LAST_TAG+2)
 #define LUA_TDEADKEY	(LAST_TAG+3)
+#define LUA_TSHAPE	(LAST_TAG+4)
+
+
+/*
+** Variant tags: `ttype' does not tell a variant from its basic type.
+** Integers are numbers held as a lua_Integer, which the virtual machine
+** keeps for integral results within LUAI_MAXINT; they are always equal
+** to the lua_Number they stand for, so scripts cannot tell them apart.
+*/
+#define VARBIT		16
+#define LUA_TINT	(LUA_TNUMBER | VARBIT)
 
 
 /*
@@ -58,10 +69,13 @@ typedef struct GCheader {
 /*
 ** Union of all Lua values
 */
+#if !defined(LUA_NANBOX)
+
 typedef union {
   GCObject *gc;
   void *p;
   lua_Number n;
+  lua_Integer i;
   int b;
 } Value;
 
@@ -72,6 +86,7 @@ typedef union {
 ** TValue +tt
 **        +Value +p
 **               +n
+**               +i
 **               +b
 **               +GCObject +TString
 **                         +Udata
@@ -85,46 +100,176 @@ typedef union {
 
 #define TValuefields	Value value; int tt
 
+#else
+
+/*
+** NaN boxing: a TValue is a single 8-byte Value. A number is stored as
+** itself; any other value is a NaN that arithmetic never produces, with
+** NB_NUMTOP+1+tag in its 17 top bits and the payload (a pointer or a
+** boolean) in its 47 low bits. The NaNs that arithmetic produces have at
+** most NB_NUMTOP in their top bits (x86-64 and ARM64 give exactly that
+** or less); setnvalue replaces any other NaN by NB_NAN. There are no
+** integer variants in this representation.
+*/
+#if !defined(LUA_NUMBER_DOUBLE) || LONG_MAX <= 2147483647L
+#error "LUA_NANBOX needs double numbers and 64-bit longs"
+#endif
+
+typedef union {
+  unsigned long u;  /* tag and payload of a value that is not a number */
+  lua_Number n;
+} Value;
+
+#define NB_SHIFT	47
+#define NB_NUMTOP	0x1fff0UL
+#define NB_PAYLOAD	((1UL << NB_SHIFT) - 1)
+#define NB_TAG(t)	((NB_NUMTOP + 1 + (t)) << NB_SHIFT)
+#define NB_MAXNUM	((NB_NUMTOP << NB_SHIFT) | NB_PAYLOAD)
+#define NB_NAN		(NB_NUMTOP << NB_SHIFT)
+
+#define TValuefields	Value value
+
+#endif
+
 typedef struct lua_TValue {
   TValuefields;
 } TValue;
 
 
-/* Macros to test type */
-/*# Checks whether TValue o is nil.*/
-#define ttisnil(o)	(ttype(o) == LUA_TNIL)
+/* Representation-dependent macros */
+#if !defined(LUA_NANBOX)
+
+#define ttype(o)	((o)->tt & (VARBIT-1))
+#define rawtt(o)	((o)->tt)
+#define checktag(o,t)	(rawtt(o) == (t))
 /*# Checks whether TValue o is of type number.*/
 #define ttisnumber(o)	(ttype(o) == LUA_TNUMBER)
-#define ttisstring(o)	(ttype(o) == LUA_TSTRING)
-#define ttistable(o)	(ttype(o) == LUA_TTABLE)
-#define ttisfunction(o)	(ttype(o) == LUA_TFUNCTION)
-#define ttisboolean(o)	(ttype(o) == LUA_TBOOLEAN)
-#define ttisuserdata(o)	(ttype(o) == LUA_TUSERDATA)
-#define ttisthread(o)	(ttype(o) == LUA_TTHREAD)
-#define ttislightuserdata(o)	(ttype(o) == LUA_TLIGHTUSERDATA)
+/*# Checks whether TValue o is a number held as an integer.*/
+#define ttisint(o)	checktag(o, LUA_TINT)
 
-/* Macros to access values */
-#define ttype(o)	((o)->tt)
-#define gcvalue(o)	check_exp(iscollectable(o), (o)->value.gc)
+#define gcval_(o)	((o)->value.gc)
 /*# Gets void pointer in TValue o.*/
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
 /*# Gets number (lua_Number) in TValue o (or asserts if not number).*/
+#define nvalue(o)	(ttisint(o) ? cast_num((o)->value.i) : \
+			 check_exp(ttisnumber(o), (o)->value.n))
+/*# Gets integer (lua_Integer) in TValue o.*/
+#define ivalue(o)	check_exp(ttisint(o), (o)->value.i)
+/*# Gets boolean (int) value in TValue o.*/
+#define bvalue(o)	check_exp(ttisboolean(o), (o)->value.b)
+
+#define setnilvalue(obj) ((obj)->tt=LUA_TNIL)
+
+/*# Sets value of TValue obj to number (lua_Number) x.*/
+#define setnvalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.n=(x); i_o->tt=LUA_TNUMBER; }
+
+/*# Sets value of TValue obj to integer x, which must fit (see fitsint).*/
+#define setivalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.i=(x); i_o->tt=LUA_TINT; }
+
+/*# Sets TValue obj to x, as an integer if x fits.*/
+#define setinteger(obj,x) \
+  { TValue *i_o=(obj); lua_Integer i_x=(x); \
+    if (fitsint(i_x)) { i_o->value.i=i_x; i_o->tt=LUA_TINT; } \
+    else { i_o->value.n=cast_num(i_x); i_o->tt=LUA_TNUMBER; } }
+
+/*# Sets TValue obj to number x, as an integer if x is one (see luaO_toint).*/
+#define setnumber(obj,x) \
+  { TValue *i_o=(obj); lua_Number i_n=(x); \
+    if (luaO_toint(i_n, &i_o->value.i)) i_o->tt=LUA_TINT; \
+    else { i_o->value.n=i_n; i_o->tt=LUA_TNUMBER; } }
+
+#define setpvalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.p=(x); i_o->tt=LUA_TLIGHTUSERDATA; }
+
+/*# Sets value of TValue obj to boolean (int 0..1) x.*/
+#define setbvalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.b=(x); i_o->tt=LUA_TBOOLEAN; }
+
+#define setgcvalue_(o,x,t) \
+  { (o)->value.gc=cast(GCObject *, (x)); (o)->tt=(t); }
+
+#define settv_(o1,o2)	{ (o1)->value = (o2)->value; (o1)->tt = (o2)->tt; }
+
+#define setttype(obj, tt) (rawtt(obj) = (tt))
+
+#define NILCONSTANT	{NULL}, LUA_TNIL
+
+#else
+
+#define rawtt(o)	(ttisnumber(o) ? LUA_TNUMBER : \
+			 cast_int(((o)->value.u >> NB_SHIFT) - NB_NUMTOP - 1))
+#define ttype(o)	rawtt(o)
+#define checktag(o,t)	((o)->value.u >> NB_SHIFT == NB_NUMTOP + 1 + (t))
+#define ttisnumber(o)	((o)->value.u <= NB_MAXNUM)
+#define ttisint(o)	0
+
+#define gcval_(o)	cast(GCObject *, (o)->value.u & NB_PAYLOAD)
+#define pvalue(o)	check_exp(ttislightuserdata(o), \
+			 cast(void *, (o)->value.u & NB_PAYLOAD))
 #define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#define ivalue(o)	cast(lua_Integer, nvalue(o))
+#define bvalue(o)	check_exp(ttisboolean(o), cast_int((o)->value.u & 1))
+
+#define setnilvalue(obj) ((obj)->value.u=NB_TAG(LUA_TNIL))
+
+#define setnvalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.n=(x); \
+    if (i_o->value.u > NB_MAXNUM) i_o->value.u=NB_NAN; }
+
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+#define setinteger(obj,x)	setnvalue(obj, cast_num(x))
+#define setnumber(obj,x)	setnvalue(obj, x)
+
+/* light userdata must fit in the payload */
+#define setpvalue(obj,x) \
+  { TValue *i_o=(obj); size_t i_p=cast(size_t, (x)); \
+    lua_assert((i_p & ~NB_PAYLOAD) == 0); \
+    i_o->value.u=NB_TAG(LUA_TLIGHTUSERDATA) | i_p; }
+
+#define setbvalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.u=NB_TAG(LUA_TBOOLEAN) | ((x) != 0); }
+
+#define setgcvalue_(o,x,t) \
+  { (o)->value.u=NB_TAG(t) | cast(size_t, (x)); }
+
+#define settv_(o1,o2)	{ (o1)->value = (o2)->value; }
+
+#define setttype(obj, tt) \
+  ((obj)->value.u = ((obj)->value.u & NB_PAYLOAD) | NB_TAG(tt))
+
+#define NILCONSTANT	{NB_TAG(LUA_TNIL)}
+
+#endif
+
+
+/* Macros to test type */
+/*# Checks whether TValue o is nil.*/
+#define ttisnil(o)	checktag(o, LUA_TNIL)
+#define ttisstring(o)	checktag(o, LUA_TSTRING)
+#define ttistable(o)	checktag(o, LUA_TTABLE)
+#define ttisfunction(o)	checktag(o, LUA_TFUNCTION)
+#define ttisboolean(o)	checktag(o, LUA_TBOOLEAN)
+#define ttisuserdata(o)	checktag(o, LUA_TUSERDATA)
+#define ttisthread(o)	checktag(o, LUA_TTHREAD)
+#define ttislightuserdata(o)	checktag(o, LUA_TLIGHTUSERDATA)
+
+/* Macros to access values */
+#define gcvalue(o)	check_exp(iscollectable(o), gcval_(o))
 /*# Gets string (TString) in TValue o.*/
-#define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
+#define rawtsvalue(o)	check_exp(ttisstring(o), &gcval_(o)->ts)
 /*# Gets string header (TString.tsv) in TValue o.*/
 #define tsvalue(o)	(&rawtsvalue(o)->tsv)
-#define rawuvalue(o)	check_exp(ttisuserdata(o), &(o)->value.gc->u)
+#define rawuvalue(o)	check_exp(ttisuserdata(o), &gcval_(o)->u)
 /*# Gets userdata header (Udata.uv) in TValue o.*/
 #define uvalue(o)	(&rawuvalue(o)->uv)
 /*# Gets closure (Closure - GCObject.cl) in TValue o.*/
-#define clvalue(o)	check_exp(ttisfunction(o), &(o)->value.gc->cl)
+#define clvalue(o)	check_exp(ttisfunction(o), &gcval_(o)->cl)
 /*# Gets table (Table - GCobject.h) in TValue o.*/
-#define hvalue(o)	check_exp(ttistable(o), &(o)->value.gc->h)
-/*# Gets boolean (int) value in TValue o.*/
-#define bvalue(o)	check_exp(ttisboolean(o), (o)->value.b)
+#define hvalue(o)	check_exp(ttistable(o), &gcval_(o)->h)
 /*# Gets thread lua_State (GCObject.th) value in Tvalue o.*/
-#define thvalue(o)	check_exp(ttisthread(o), &(o)->value.gc->th)
+#define thvalue(o)	check_exp(ttisthread(o), &gcval_(o)->th)
 
 /*# Gets whether TValue o evaluates to false (i.e. is nil or false).*/
 #define l_isfalse(o)	(ttisnil(o) || (ttisboolean(o) && bvalue(o) == 0))
@@ -133,55 +278,45 @@ typedef struct lua_TValue {
 ** for internal debug only
 */
 #define checkconsistency(obj) \
-  lua_assert(!iscollectable(obj) || (ttype(obj) == (obj)->value.gc->gch.tt))
+  lua_assert(!iscollectable(obj) || (ttype(obj) == gcval_(obj)->gch.tt))
 
 #define checkliveness(g,obj) \
   lua_assert(!iscollectable(obj) || \
-  ((ttype(obj) == (obj)->value.gc->gch.tt) && !isdead(g, (obj)->value.gc)))
+  ((ttype(obj) == gcval_(obj)->gch.tt) && !isdead(g, gcval_(obj))))
 
 
 /* Macros to set values */
-#define setnilvalue(obj) ((obj)->tt=LUA_TNIL)
-
-/*# Sets value of TValue obj to number (lua_Number) x.*/
-#define setnvalue(obj,x) \
-  { TValue *i_o=(obj); i_o->value.n=(x); i_o->tt=LUA_TNUMBER; }
-
-#define setpvalue(obj,x) \
-  { TValue *i_o=(obj); i_o->value.p=(x); i_o->tt=LUA_TLIGHTUSERDATA; }
-
-/*# Sets value of TValue obj to boolean (int 0..1) x.*/
-#define setbvalue(obj,x) \
-  { TValue *i_o=(obj); i_o->value.b=(x); i_o->tt=LUA_TBOOLEAN; }
+#define fitsint(x) \
+  (cast(size_t, (x) + LUAI_MAXINT) <= cast(size_t, 2*LUAI_MAXINT))
 
 #define setsvalue(L,obj,x) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TSTRING; \
+    setgcvalue_(i_o, x, LUA_TSTRING); \
     checkliveness(G(L),i_o); }
 
 #define setuvalue(L,obj,x) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TUSERDATA; \
+    setgcvalue_(i_o, x, LUA_TUSERDATA); \
     checkliveness(G(L),i_o); }
 
 #define setthvalue(L,obj,x) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TTHREAD; \
+    setgcvalue_(i_o, x, LUA_TTHREAD); \
     checkliveness(G(L),i_o); }
 
 #define setclvalue(L,obj,x) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TFUNCTION; \
+    setgcvalue_(i_o, x, LUA_TFUNCTION); \
     checkliveness(G(L),i_o); }
 
 #define sethvalue(L,obj,x) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TTABLE; \
+    setgcvalue_(i_o, x, LUA_TTABLE); \
     checkliveness(G(L),i_o); }
 
 #define setptvalue(L,obj,x) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TPROTO; \
+    setgcvalue_(i_o, x, LUA_TPROTO); \
     checkliveness(G(L),i_o); }
 
 
@@ -189,7 +324,7 @@ typedef struct lua_TValue {
 
 #define setobj(L,obj1,obj2) \
   { const TValue *o2=(obj2); TValue *o1=(obj1); \
-    o1->value = o2->value; o1->tt=o2->tt; \
+    settv_(o1, o2); \
     checkliveness(G(L),o1); }
 
 
@@ -212,8 +347,6 @@ typedef struct lua_TValue {
 #define setobj2n	setobj
 #define setsvalue2n	setsvalue
 
-#define setttype(obj, tt) (ttype(obj) = (tt))
-
 
 #define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
 
@@ -263,6 +396,13 @@ typedef union Udata {
 /*
 ** Function Prototypes
 */
+
+/*
+** function compiled ahead of time (see `luac -C'); runs the Lua function
+** from instruction `pc' up to a call or return, and returns its index
+*/
+typedef int (*lua_Native) (lua_State *L, int pc);
+
 /*# Every definition of a Lua function (or C function exposed as a Lua function)
 is represented with a function prototype object.
 This contains things like a list of bytecode instructions (code),
@@ -284,6 +424,9 @@ typedef struct Proto {
   CommonHeader;
   TValue *k;  /* constants used by the function */
   Instruction *code;
+  int *cache;  /* inline caches for `code' (node slot of a constant key) */
+  struct JitCode *jitcode;  /* compiled `code' (see ljit.c) */
+  lua_Native native;  /* `code' compiled ahead of time (see luac -C) */
   struct Proto **p;  /* functions defined inside the function */
   int *lineinfo;  /* map from opcodes to source lines */
   struct LocVar *locvars;  /* information about local variables */
@@ -292,11 +435,13 @@ typedef struct Proto {
   int sizeupvalues;
   int sizek;  /* size of `k' */
   int sizecode;
+  int sizecache;
   int sizelineinfo;
   int sizep;  /* size of `p' */
   int sizelocvars;
   int linedefined;
   int lastlinedefined;
+  int ncalls;  /* calls before compilation; -1 if it is not possible */
   GCObject *gclist;
   lu_byte nups;  /* number of upvalues */
   lu_byte numparams;
@@ -436,28 +581,85 @@ typedef struct Node {
 } Node;
 
 
+/*# Represents the string keys of a record table, in slot order.
+Shapes are immutable and shared: tables that got the same string keys
+in the same order point to the same shape, which is found from its
+parent (the shape without the last key) through `G(L)->shapet`.*/
+typedef struct Shape {
+  CommonHeader;
+  lu_byte nkeys;  /* number of keys */
+  lu_int32 keymask;  /* 1<<(hash%32) for each key (fast misses) */
+  unsigned int hash;  /* hash of (parent, last key) */
+  struct Shape *parent;
+  struct Shape *hnext;  /* chain in `shapet' */
+  TString *keys[1];  /* `nkeys' keys; slot i holds the value of keys[i] */
+} Shape;
+
+#define sizeshape(n)	(cast(int, sizeof(Shape)) + \
+			 (cast(int, n)-1)*cast(int, sizeof(TString *)))
+
+
+#if defined(LUA_USE_PACKED)
+
+/*# A position of a packed array part: a number, or nil as the NaN PK_NIL
+(which arithmetic never produces).*/
+typedef union PackedNum {
+  lua_Number n;
+  unsigned long u;
+} PackedNum;
+
+#define PK_NIL		0x7ffa5a5a5a5a5a5aUL
+
+#endif
+
+
 /*# Represents a Lua table ({}).
 These are linked to TValues.
 
 Note: each table can have an optional metatable and can have
 an array part (stored in array `array` of length `sizearray` and
 a hash part (stored in array `node` of length encoded in `lsizenode`).
+A table with a `shape` keeps its string keys there instead of in the
+hash part, and their values in array `slots` (of length `sizeslots`).
+An array part holding only numbers may be `packed` (see ltable.c).
 
-You can quickly check for certain metamethods via the `flags` field
-rather than looking in the metatable.*/
+You can quickly check for the absence of any metamethod via the `flags`
+field rather than looking in the metatable.*/
 typedef struct Table {
   CommonHeader;
-  lu_byte flags;  /* 1<<p means tagmethod(p) is not present */ 
   lu_byte lsizenode;  /* log2 of size of `node' array */
+  lu_byte sizeslots;  /* size of `slots' array */
+  lu_int32 flags;  /* 1<<p means tagmethod(p) is not present */ 
   struct Table *metatable;
   TValue *array;  /* array part */
   Node *node;
+#if defined(LUA_OPENHASH)
+  int nfree;  /* number of keys that still fit in `node' */
+#else
   Node *lastfree;  /* any free position is before this position */
+#endif
+  struct Shape *shape;  /* string keys (NULL: they are in `node') */
+  TValue *slots;  /* values of the keys in `shape' */
+  struct OldHash *old;  /* hash part still being moved into `node' */
   GCObject *gclist;
   int sizearray;  /* size of `array' array */
+  unsigned int border;  /* boundary last found by `luaH_getn' */
+#if defined(LUA_USE_PACKED)
+  lu_byte packed;  /* `array' holds PackedNums (see ltable.c) */
+#endif
+  unsigned int mcepoch;  /* method-cache epoch that depends on this table */
 } Table;
 
 
+/*# Represents the hash part a large table had before it grew.
+Its keys move to the new hash part a few at a time (see `grow` in
+ltable.c); until then searches that miss in the new part go on here.*/
+typedef struct OldHash {
+  Table h;  /* a table with only this hash part */
+  int moved;  /* positions of `h.node' already moved */
+} OldHash;
+
+
 
 /*
 ** `module' operation for hashing (size is always a power of 2)
@@ -481,6 +683,7 @@ LUAI_FUNC int luaO_log2 (unsigned int x);
 LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
+LUAI_FUNC int luaO_toint (lua_Number n, lua_Integer *i);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
@@ -52,6 +52,21 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSE",
   "CLOSURE",
   "VARARG",
+  "ADDNN",
+  "SUBNN",
+  "MULNN",
+  "DIVNN",
+  "ADDNK",
+  "SUBNK",
+  "MULNK",
+  "LTNN",
+  "LENN",
+  "FORLOOPUP",
+  "FORLOOPDOWN",
+  "MOVECALL",
+  "GETTABLECALL",
+  "GETUPVALTABLE",
+  "VARSELECT",
   NULL
 };
 
@@ -98,6 +113,41 @@ const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, OpArgN, OpArgN, iABC)		/* OP_CLOSE */
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDNN */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUBNN */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULNN */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_DIVNN */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDNK */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUBNK */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULNK */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LTNN */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LENN */
+ ,opmode(0, 1, OpArgR, OpArgN, iAsBx)		/* OP_FORLOOPUP */
+ ,opmode(0, 1, OpArgR, OpArgN, iAsBx)		/* OP_FORLOOPDOWN */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVECALL */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLECALL */
+ ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_GETUPVALTABLE */
+ ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARSELECT */
+};
+
+
+/*
+** generic form of each opcode: a quickened instruction is saved (and
+** checked) as its generic form, and so is the first word of a fused pair
+*/
+const lu_byte luaP_opbase[NUM_OPCODES] = {
+  OP_MOVE, OP_LOADK, OP_LOADBOOL, OP_LOADNIL, OP_GETUPVAL, OP_GETGLOBAL,
+  OP_GETTABLE, OP_SETGLOBAL, OP_SETUPVAL, OP_SETTABLE, OP_NEWTABLE, OP_SELF,
+  OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW, OP_UNM, OP_NOT, OP_LEN,
+  OP_CONCAT, OP_JMP, OP_EQ, OP_LT, OP_LE, OP_TEST, OP_TESTSET, OP_CALL,
+  OP_TAILCALL, OP_RETURN, OP_FORLOOP, OP_FORPREP, OP_TFORLOOP, OP_SETLIST,
+  OP_CLOSE, OP_CLOSURE, OP_VARARG,
+  OP_ADD, OP_SUB, OP_MUL, OP_DIV,  /* OP_ADDNN ... OP_DIVNN */
+  OP_ADD, OP_SUB, OP_MUL,  /* OP_ADDNK ... OP_MULNK */
+  OP_LT, OP_LE,  /* OP_LTNN, OP_LENN */
+  OP_FORLOOP, OP_FORLOOP,  /* OP_FORLOOPUP, OP_FORLOOPDOWN */
+  OP_MOVE, OP_GETTABLE, OP_GETUPVAL,  /* OP_MOVECALL ... OP_GETUPVALTABLE */
+  OP_VARARG  /* OP_VARSELECT */
 };
 
 
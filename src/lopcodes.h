@@ -214,11 +214,36 @@ OP_SETLIST,/*	A B C	R(A)[(C-1)*FPF+i] := R(A+i), 1 <= i <= B	*/
 OP_CLOSE,/*	A 	close all variables in the stack up to (>=) R(A)*/
 OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx], R(A), ... ,R(A+n))	*/
 
-OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+
+/* specialized (quickened) forms, created only at run time by `luaV_execute' */
+OP_ADDNN,/*	A B C	R(A) := RK(B) + RK(C)	(numbers)		*/
+OP_SUBNN,/*	A B C	R(A) := RK(B) - RK(C)	(numbers)		*/
+OP_MULNN,/*	A B C	R(A) := RK(B) * RK(C)	(numbers)		*/
+OP_DIVNN,/*	A B C	R(A) := RK(B) / RK(C)	(numbers)		*/
+OP_ADDNK,/*	A B C	R(A) := RK(B) + Kst(C)	(numbers)		*/
+OP_SUBNK,/*	A B C	R(A) := RK(B) - Kst(C)	(numbers)		*/
+OP_MULNK,/*	A B C	R(A) := RK(B) * Kst(C)	(numbers)		*/
+OP_LTNN,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++	(numbers)	*/
+OP_LENN,/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++	(numbers)	*/
+OP_FORLOOPUP,/*	A sBx	OP_FORLOOP with integers and step > 0		*/
+OP_FORLOOPDOWN,/*	A sBx	OP_FORLOOP with integers and step <= 0		*/
+
+/* fused pairs, created by `luaK_fuse': this instruction and the next one */
+OP_MOVECALL,/*	A B	R(A) := R(B); then CALL				*/
+OP_GETTABLECALL,/*	A B C	R(A) := R(B)[RK(C)]; then CALL			*/
+OP_GETUPVALTABLE,/*	A B	R(A) := UpValue[B]; then GETTABLE		*/
+OP_VARSELECT/*	A B	R(A), ... := vararg; then CALL (see note)	*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_VARARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_VARSELECT) + 1)
+
+/* an opcode is quickened (or fused) when its generic form is another one */
+#define isquickened(o)	(luaP_opbase[o] != (o))
+
+/* fused pairs come last */
+#define isfused(o)	((o) >= OP_MOVECALL)
 
 
 
@@ -231,6 +256,11 @@ OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
   (*) In OP_VARARG, if (B == 0) then use actual number of varargs and
       set top (like in OP_CALL with C == 0).
 
+  (*) OP_VARSELECT is an OP_VARARG with B == 0 passing all varargs to the
+      OP_CALL after it, which calls R(A-2) with R(A-1) first. When R(A-2)
+      is the `select' of the base library (`luaA_select'), the pair takes
+      the selected varargs in place and skips the call.
+
   (*) In OP_RETURN, if (B == 0) then return up to `top'
 
   (*) In OP_SETLIST, if (B == 0) then B = `top';
@@ -270,6 +300,8 @@ LUAI_DATA const lu_byte luaP_opmodes[NUM_OPCODES];
 
 LUAI_DATA const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
+LUAI_DATA const lu_byte luaP_opbase[NUM_OPCODES];  /* generic forms */
+
 
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
@@ -42,6 +42,13 @@ typedef struct stringtable {
 } stringtable;
 
 
+typedef struct shapetable {
+  struct Shape **hash;
+  lu_int32 nuse;  /* number of elements */
+  int size;
+} shapetable;
+
+
 /*
 ** informations about a call
 */
@@ -67,6 +74,8 @@ typedef struct CallInfo {
 */
 typedef struct global_State {
   stringtable strt;  /* hash table for strings */
+  shapetable shapet;  /* hash table for shapes (see `luaH_addkey') */
+  struct Shape *shape0;  /* shape without keys (NULL: no shapes) */
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to `frealloc' */
   lu_byte currentwhite;
@@ -91,6 +100,9 @@ typedef struct global_State {
   UpVal uvhead;  /* head of double-linked list of all open upvalues */
   struct Table *mt[NUM_TAGS];  /* metatables for basic types */
   TString *tmname[TM_N];  /* array with tag-method names */
+  unsigned int mcepoch;  /* current epoch of the method cache */
+  MCache mcache[MCACHESIZE];  /* method cache (see `luaV_getmethod') */
+  struct JitState *jit;  /* trace compiler state (NULL when off) */
 } global_State;
 
 
@@ -141,6 +153,7 @@ union GCObject {
   struct Table h;
   struct Proto p;
   struct UpVal uv;
+  struct Shape sh;
   struct lua_State th;  /* thread */
 };
 
@@ -156,6 +169,7 @@ union GCObject {
 #define gco2uv(o)	check_exp((o)->gch.tt == LUA_TUPVAL, &((o)->uv))
 #define ngcotouv(o) \
 	check_exp((o) == NULL || (o)->gch.tt == LUA_TUPVAL, &((o)->uv))
+#define gco2sh(o)	check_exp((o)->gch.tt == LUA_TSHAPE, &((o)->sh))
 #define gco2th(o)	check_exp((o)->gch.tt == LUA_TTHREAD, &((o)->th))
 
 /* macro to convert any Lua object into a GCObject */
@@ -16,6 +16,15 @@
 ** in its main position (i.e. the `original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** With LUA_OPENHASH the hash part uses open addressing instead: a key
+** goes to the first position after its main position (in circular
+** order) whose value is nil, and a search stops at a position that
+** never had a key. Keys are not removed until the next rehash, which
+** keeps the load factor at most 1/2, so probes stay short.
+** Record tables keep their string keys in a `shape' shared with every
+** table that got the same keys in the same order, and their values in
+** a dense vector of slots; the hash part then holds only other keys.
+** An array part holding only numbers may be `packed', without type tags.
 */
 
 #include <math.h>
@@ -33,6 +42,8 @@
 #include "lobject.h"
 #include "lstate.h"
 #include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
 
 
 /*
@@ -47,11 +58,20 @@
 #define MAXASIZE	(1 << MAXBITS)
 
 
-#define hashpow2(t,n)      (gnode(t, lmod((n), sizenode(t))))
-  
-#define hashstr(t,str)  hashpow2(t, (str)->tsv.hash)
-#define hashboolean(t,p)        hashpow2(t, p)
+#if defined(LUA_OPENHASH)
 
+/*
+** open addressing needs neighbouring keys to spread out, so every hash
+** is scrambled (multiplying by 2^32 divided by the golden ratio) and its
+** top bits are used
+*/
+#define hashpow2(t,n) \
+	(gnode(t, ((cast(lu_int32, n) * 2654435769u) >> (31 - (t)->lsizenode)) >> 1))
+#define hashmod(t,n)	hashpow2(t,n)
+
+#else
+
+#define hashpow2(t,n)      (gnode(t, lmod((n), sizenode(t))))
 
 /*
 ** for some types, it is better to avoid modulus by power of 2, as
@@ -59,10 +79,33 @@
 */
 #define hashmod(t,n)	(gnode(t, ((n) % ((sizenode(t)-1)|1))))
 
+#endif
+  
+#define hashstr(t,str)  hashpow2(t, (str)->tsv.hash)
+#define hashboolean(t,p)        hashpow2(t, p)
+
 
 #define hashpointer(t,p)	hashmod(t, IntPoint(p))
 
 
+#if defined(LUA_OPENHASH)
+
+/* next position to search after `n'; NULL if `n' never had a key */
+#define probenext(t,n) \
+	(ttisnil(gkey(n)) ? NULL : \
+	 gnode(t, lmod(cast_int((n) - gnode(t, 0)) + 1, sizenode(t))))
+
+/* number of keys that fit in a hash part with `sz' positions */
+#define maxuse(sz)	((sz) >> 1)
+
+#else
+
+#define probenext(t,n)	gnext(n)
+#define maxuse(sz)	(sz)
+
+#endif
+
+
 /*
 ** number of ints inside a lua_Number
 */
@@ -73,8 +116,8 @@
 #define dummynode		(&dummynode_)
 
 static const Node dummynode_ = {
-  {{NULL}, LUA_TNIL},  /* value */
-  {{{NULL}, LUA_TNIL, NULL}}  /* key */
+  {NILCONSTANT},  /* value */
+  {{NILCONSTANT, NULL}}  /* key */
 };
 
 
@@ -118,7 +161,12 @@ static Node *mainposition (const Table *t, const TValue *key) {
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
-  if (ttisnumber(key)) {
+  if (ttisint(key)) {
+    lua_Integer k = ivalue(key);
+    if (cast(lua_Integer, cast_int(k)) == k)
+      return cast_int(k);
+  }
+  else if (ttisnumber(key)) {
     lua_Number n = nvalue(key);
     int k;
     lua_number2int(k, n);
@@ -129,53 +177,161 @@ static int arrayindex (const TValue *key) {
 }
 
 
+#define keybit(key)	(cast(lu_int32, 1) << ((key)->tsv.hash & 31))
+
+
+/*
+** returns the slot of `key' in shape `s', or -1 if it is not there
+*/
+static int shapeslot (const Shape *s, TString *key) {
+  if (s->keymask & keybit(key)) {  /* may be there? */
+    int i = s->nkeys;
+    while (i--) {
+      if (s->keys[i] == key) return i;
+    }
+  }
+  return -1;
+}
+
+
+/*
+** returns the position of `key' in the hash part of `t', or -1
+*/
+static int nodeindex (const Table *t, StkId key) {
+  Node *n = mainposition(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    /* key may be dead already, but it is ok to use it in `next' */
+    if (luaO_rawequalObj(key2tval(n), key) ||
+          (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
+           gcvalue(gkey(n)) == gcvalue(key)))
+      return cast_int(n - gnode(t, 0));  /* key index in hash table */
+    else n = probenext(t, n);
+  } while (n);
+  return -1;
+}
+
+
 /*
 ** returns the index of a `key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signalled by -1.
+** elements in the array part, then the slots, then elements in the hash
+** part (and in the old hash part, if it is still there). The beginning
+** of a traversal is signalled by -1; a key not in the table gives -2.
 */
-static int findindex (lua_State *L, Table *t, StkId key) {
+static int keyindex (Table *t, StkId key) {
   int i;
   if (ttisnil(key)) return -1;  /* first iteration */
   i = arrayindex(key);
   if (0 < i && i <= t->sizearray)  /* is `key' inside array part? */
     return i-1;  /* yes; that's the index (corrected to C) */
+  else if (t->shape && ttisstring(key)) {  /* key must be in a slot */
+    i = shapeslot(t->shape, rawtsvalue(key));
+    return (i >= 0) ? i + t->sizearray : -2;
+  }
   else {
-    Node *n = mainposition(t, key);
-    do {  /* check whether `key' is somewhere in the chain */
-      /* key may be dead already, but it is ok to use it in `next' */
-      if (luaO_rawequalObj(key2tval(n), key) ||
-            (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
-             gcvalue(gkey(n)) == gcvalue(key))) {
-        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        return i + t->sizearray;
-      }
-      else n = gnext(n);
-    } while (n);
-    luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* key not found */
-    return 0;  /* to avoid warnings */
+    /* hash elements are numbered after array ones and slots */
+    int base = t->sizearray + nslots(t);
+    i = nodeindex(t, key);
+    if (i >= 0) return i + base;
+    if (t->old) {  /* maybe not moved yet */
+      i = nodeindex(&t->old->h, key);
+      if (i >= 0) return i + base + sizenode(t);
+    }
+    return -2;  /* key not found */
   }
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
-  int i = findindex(L, t, key);  /* find original element */
+static int findindex (lua_State *L, Table *t, StkId key) {
+  int i = keyindex(t, key);
+  if (i == -2)
+    luaG_runerror(L, "invalid key to " LUA_QL("next"));
+  return i;
+}
+
+
+/*
+** puts in `key' and `key+1' the first element after index `i' (as given
+** by `findindex') and returns its index, or -1 when there is none
+*/
+static int nextindex (lua_State *L, Table *t, StkId key, int i) {
+  int ns = nslots(t);
   for (i++; i < t->sizearray; i++) {  /* try first array part */
-    if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));
-      setobj2s(L, key+1, &t->array[i]);
-      return 1;
+    if (!arrisnil(t, i)) {  /* a non-nil value? */
+      setivalue(key, i+1);
+      getarray(L, t, i, key+1);
+      return i;
     }
   }
-  for (i -= t->sizearray; i < sizenode(t); i++) {  /* then hash part */
+  for (i -= t->sizearray; i < ns; i++) {  /* then slots */
+    if (!ttisnil(&t->slots[i])) {  /* a non-nil value? */
+      setsvalue2s(L, key, t->shape->keys[i]);
+      setobj2s(L, key+1, &t->slots[i]);
+      return i + t->sizearray;
+    }
+  }
+  for (i -= ns; i < sizenode(t); i++) {  /* then hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, key2tval(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
-      return 1;
+      return i + t->sizearray + ns;
     }
   }
-  return 0;  /* no more elements */
+  if (t->old) {  /* then keys not moved yet (moved ones have nil values) */
+    Table *o = &t->old->h;
+    for (i -= sizenode(t); i < sizenode(o); i++) {
+      if (!ttisnil(gval(gnode(o, i)))) {  /* a non-nil value? */
+        setobj2s(L, key, key2tval(gnode(o, i)));
+        setobj2s(L, key+1, gval(gnode(o, i)));
+        return i + t->sizearray + ns + sizenode(t);
+      }
+    }
+  }
+  return -1;  /* no more elements */
+}
+
+
+/*
+** checks whether `key' is the key at traversal index `i'
+*/
+static int keyat (Table *t, StkId key, int i) {
+  int ns = nslots(t);
+  if (i < 0) return 0;
+  else if (i < t->sizearray) return arrayindex(key) == i+1;
+  i -= t->sizearray;
+  if (i < ns)
+    return ttisstring(key) && t->shape->keys[i] == rawtsvalue(key);
+  i -= ns;
+  if (i < sizenode(t))
+    return luaO_rawequalObj(key2tval(gnode(t, i)), key);
+  i -= sizenode(t);
+  return t->old && i < sizenode(&t->old->h) &&
+         luaO_rawequalObj(key2tval(gnode(&t->old->h, i)), key);
+}
+
+
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  return nextindex(L, t, key, findindex(L, t, key)) >= 0;
+}
+
+
+/*
+** `luaH_next' for a traversal that keeps in `cursor' the index of the
+** key it returned last. While `key' is still found at that index (the
+** table was not rehashed), the key is not searched for again. Returns
+** -1, instead of raising an error, for a key not in the table.
+*/
+int luaH_nextc (lua_State *L, Table *t, StkId key, int *cursor) {
+  int i = *cursor;
+  if (ttisnil(key))
+    i = -1;  /* first iteration */
+  else if (!keyat(t, key, i)) {
+    i = keyindex(t, key);  /* not where it was: search it */
+    if (i == -2) return -1;
+  }
+  i = nextindex(L, t, key, i);
+  if (i < 0) return 0;
+  *cursor = i;
+  return 1;
 }
 
 
@@ -234,7 +390,7 @@ static int numusearray (const Table *t, int *nums) {
     }
     /* count elements in range (2^(lg-1), 2^lg] */
     for (; i <= lim; i++) {
-      if (!ttisnil(&t->array[i-1]))
+      if (!arrisnil(t, i-1))
         lc++;
     }
     nums[lg] += lc;
@@ -260,8 +416,108 @@ static int numusehash (const Table *t, int *nums, int *pnasize) {
 }
 
 
+#if defined(LUA_USE_PACKED)
+
+/*
+** A packed array part is a vector of PackedNums, half the size of
+** TValues and with nothing for the collector to traverse. `luaH_getnum'
+** and `luaH_get' return a number read from it in the caller's `tmp'
+** (see ltable.h). Storing something
+** that is not a number through `luaH_setarray' or `luaH_setobj', or
+** asking `luaH_set' or `luaH_setnum' for a position in the array part
+** (the caller may store anything there), unpacks the array part. New
+** tables start packed, and a resize packs again an array part that
+** holds only numbers.
+*/
+
+/*
+** stores `v' in `p' and returns 1, if `v' can be packed
+*/
+static int packvalue (PackedNum *p, const TValue *v) {
+  PackedNum x;
+  if (ttisnil(v))
+    x.u = PK_NIL;
+  else if (!ttisnumber(v))
+    return 0;
+  else {
+    x.n = nvalue(v);
+    if (x.u == PK_NIL) return 0;  /* this NaN means nil */
+  }
+  *p = x;
+  return 1;
+}
+
+
+static void pack (lua_State *L, Table *t) {
+  int n = t->sizearray;
+  TValue *a = t->array;
+  PackedNum x;
+  int i;
+  for (i = 0; i < n; i++) {
+    if (!packvalue(&x, &a[i]))
+      return;  /* not only numbers */
+  }
+  t->array = cast(TValue *, luaM_newvector(L, n, PackedNum));
+  t->packed = 1;
+  for (i = 0; i < n; i++)
+    packvalue(pkarray(t) + i, &a[i]);
+  luaM_freearray(L, a, n, TValue);
+}
+
+
+static void unpack (lua_State *L, Table *t) {
+  int n = t->sizearray;
+  TValue *a = luaM_newvector(L, n, TValue);
+  int i;
+  for (i = 0; i < n; i++)
+    getarray(L, t, i, &a[i]);
+  luaM_freearray(L, t->array, n, PackedNum);
+  t->array = a;
+  t->packed = 0;
+}
+
+
+/*
+** returns the position of `key' in the array part of `t', if `t' is
+** packed and `key' is there; -1 otherwise
+*/
+int luaH_packedslot (const Table *t, const TValue *key) {
+  if (t->packed && ttisnumber(key)) {
+    int k = arrayindex(key);
+    if (cast(unsigned int, k-1) < cast(unsigned int, t->sizearray))
+      return k-1;
+  }
+  return -1;
+}
+
+
+/*
+** stores `v' in position `n' of the array part of `t' (see `setarray')
+*/
+void luaH_setarray (lua_State *L, Table *t, int n, const TValue *v) {
+  if (t->packed) {
+    if (packvalue(pkarray(t) + n, v)) return;
+    unpack(L, t);
+  }
+  setobj2t(L, &t->array[n], v);
+  luaC_barriert(L, t, v);
+}
+
+#endif
+
+
 static void setarrayvector (lua_State *L, Table *t, int size) {
   int i;
+#if defined(LUA_USE_PACKED)
+  if (t->packed) {
+    t->array = cast(TValue *, luaM_reallocv(L, t->array, t->sizearray, size,
+                                            sizeof(PackedNum)));
+    for (i=t->sizearray; i<size; i++)
+      pkarray(t)[i].u = PK_NIL;
+    t->sizearray = size;
+    return;
+  }
+#endif
   luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
   for (i=t->sizearray; i<size; i++)
      setnilvalue(&t->array[i]);
@@ -277,7 +533,9 @@ static void setnodevector (lua_State *L, Table *t, int size) {
   }
   else {
     int i;
+    int nsize = size;
     lsize = ceillog2(size);
+    while (maxuse(twoto(lsize)) < nsize) lsize++;  /* leave free positions */
     if (lsize > MAXBITS)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
@@ -290,15 +548,204 @@ static void setnodevector (lua_State *L, Table *t, int size) {
     }
   }
   t->lsizenode = cast_byte(lsize);
+#if defined(LUA_OPENHASH)
+  t->nfree = (size == 0) ? 0 : maxuse(size);
+#else
   t->lastfree = gnode(t, size);  /* all positions are free */
+#endif
 }
 
 
-static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
+static void setslotvector (lua_State *L, Table *t, int size) {
   int i;
-  int oldasize = t->sizearray;
+  luaM_reallocvector(L, t->slots, t->sizeslots, size, TValue);
+  for (i=t->sizeslots; i<size; i++)
+     setnilvalue(&t->slots[i]);
+  t->sizeslots = cast_byte(size);
+}
+
+
+#if defined(LUA_OPENHASH)
+
+/*
+** inserts a new key into a hash table: it goes to the first position of
+** its search sequence with a nil value; that is either a position that
+** never had a key, while there is room for another one, or that of a
+** key already removed (but still needed to continue other searches).
+** Returns NULL when the hash part has no room for the key.
+*/
+static TValue *insertkey (lua_State *L, Table *t, const TValue *key) {
+  Node *n = mainposition(t, key);
+  while (!ttisnil(gval(n)))  /* find a position with a nil value */
+    n = gnode(t, lmod(cast_int(n - gnode(t, 0)) + 1, sizenode(t)));
+  if (ttisnil(gkey(n))) {  /* never had a key? */
+    if (t->nfree == 0)  /* no room for another one? */
+      return NULL;
+    t->nfree--;
+  }
+  setobj2t(L, key2tval(n), key);
+  luaC_barriert(L, t, key);
+  lua_assert(ttisnil(gval(n)));
+  return gval(n);
+}
+
+#else
+
+static Node *getfreepos (Table *t) {
+  while (t->lastfree-- > t->node) {
+    if (ttisnil(gkey(t->lastfree)))
+      return t->lastfree;
+  }
+  return NULL;  /* could not find a free place */
+}
+
+
+
+/*
+** inserts a new key into a hash table; first, check whether key's main 
+** position is free. If not, check whether colliding node is in its main 
+** position or not: if it is not, move colliding node to an empty place and 
+** put new key in its main position; otherwise (colliding node is in its main 
+** position), new key goes to an empty position. Returns NULL when there
+** is no empty position left.
+*/
+static TValue *insertkey (lua_State *L, Table *t, const TValue *key) {
+  Node *mp = mainposition(t, key);
+  if (!ttisnil(gval(mp)) || mp == dummynode) {
+    Node *othern;
+    Node *n = getfreepos(t);  /* get a free place */
+    if (n == NULL)  /* cannot find a free place? */
+      return NULL;
+    lua_assert(n != dummynode);
+    othern = mainposition(t, key2tval(mp));
+    if (othern != mp) {  /* is colliding node out of its main position? */
+      /* yes; move colliding node into free position */
+      while (gnext(othern) != mp) othern = gnext(othern);  /* find previous */
+      gnext(othern) = n;  /* redo the chain with `n' in place of `mp' */
+      *n = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
+      gnext(mp) = NULL;  /* now `mp' is free */
+      setnilvalue(gval(mp));
+    }
+    else {  /* colliding node is in its own main position */
+      /* new node will go into free position */
+      gnext(n) = gnext(mp);  /* chain new position */
+      gnext(mp) = n;
+      mp = n;
+    }
+  }
+  setobj2t(L, key2tval(mp), key);
+  luaC_barriert(L, t, key);
+  lua_assert(ttisnil(gval(mp)));
+  return gval(mp);
+}
+
+#endif
+
+
+/*
+** Large hash parts grow incrementally: when a hash part with at least
+** MININCR positions is full, it becomes the `old' part of the table
+** and a hash part twice as large replaces it. New keys go to the new
+** part, and each of them also moves INCRSTEP positions of the old part
+** into it, so the old part is empty before the new one can fill up
+** (INCRSTEP must be at least 2 when only half of a part can be used).
+** A moved key stays in the old part as a dead key with a nil value, to
+** keep the searches that pass by it going. Searches do not move keys:
+** they must not change the positions of keys seen by `next', or the
+** values they return.
+*/
+#define MININCR		(1 << 14)
+#define INCRSTEP	4
+
+
+static void freeold (lua_State *L, Table *t) {
+  OldHash *o = t->old;
+  t->old = NULL;
+  if (o->h.node != dummynode)
+    luaM_freearray(L, o->h.node, sizenode(&o->h), Node);
+  luaM_free(L, o);
+}
+
+
+/*
+** moves up to `n' positions of the old hash part into the hash part
+*/
+static void moveold (lua_State *L, Table *t, int n) {
+  OldHash *o = t->old;
+  int size = sizenode(&o->h);
+  while (n-- > 0 && o->moved < size) {
+    Node *old = gnode(&o->h, o->moved++);
+    if (!ttisnil(gval(old))) {
+      TValue *v = insertkey(L, t, key2tval(old));
+      lua_assert(v != NULL);  /* new part is big enough */
+      setobjt2t(L, v, gval(old));
+      setnilvalue(gval(old));
+    }
+    if (!ttisnil(gkey(old)))  /* a removed key must not come back here */
+      setttype(gkey(old), LUA_TDEADKEY);  /* key is not here any more */
+  }
+  if (o->moved == size)  /* all moved? */
+    freeold(L, t);
+}
+
+
+#define finishmove(L,t)	{ if ((t)->old) moveold(L, t, MAX_INT); }
+
+
+/*
+** replaces the full hash part of `t' by one twice as large, keeping it
+** as the old part
+*/
+static void grow (lua_State *L, Table *t) {
+  OldHash *o = luaM_new(L, OldHash);
+  Table *h = &o->h;
+  Node *nold = t->node;
   int oldhsize = t->lsizenode;
-  Node *nold = t->node;  /* save old hash ... */
+  lua_assert(t->old == NULL);
+  h->node = cast(Node *, dummynode);  /* empty until the new part exists */
+  h->lsizenode = 0;
+  h->array = NULL;
+  h->sizearray = 0;
+#if defined(LUA_USE_PACKED)
+  h->packed = 0;
+#endif
+  h->shape = NULL;
+  h->slots = NULL;
+  h->sizeslots = 0;
+  h->old = NULL;
+  o->moved = 0;
+  t->old = o;
+  setnodevector(L, t, 2*maxuse(twoto(oldhsize)));
+  h->node = nold;
+  h->lsizenode = cast_byte(oldhsize);
+}
+
+
+/*
+** puts back a key of the old hash part of `t', which is being resized
+*/
+static void reinsert (lua_State *L, Table *t, const TValue *key,
+                      const TValue *val) {
+#if defined(LUA_USE_PACKED)
+  int n = luaH_packedslot(t, key);
+  if (n >= 0) {  /* keep a packed array part packed, if possible */
+    luaH_setarray(L, t, n, val);
+    return;
+  }
+#endif
+  setobjt2t(L, luaH_set(L, t, key), val);
+}
+
+
+static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
+  int i;
+  int oldasize;
+  int oldhsize;
+  Node *nold;
+  finishmove(L, t);  /* hash part must be complete */
+  oldasize = t->sizearray;
+  oldhsize = t->lsizenode;
+  nold = t->node;  /* save old hash ... */
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
@@ -307,34 +754,68 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
     t->sizearray = nasize;
     /* re-insert elements from vanishing slice */
     for (i=nasize; i<oldasize; i++) {
-      if (!ttisnil(&t->array[i]))
-        setobjt2t(L, luaH_setnum(L, t, i+1), &t->array[i]);
+      if (!arrisnil(t, i)) {
+        TValue v;
+        getarray(L, t, i, &v);
+        setobjt2t(L, luaH_setnum(L, t, i+1), &v);
+      }
     }
     /* shrink array */
-    luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
+    t->sizearray = oldasize;
+    setarrayvector(L, t, nasize);
   }
   /* re-insert elements from hash part */
   for (i = twoto(oldhsize) - 1; i >= 0; i--) {
     Node *old = nold+i;
     if (!ttisnil(gval(old)))
-      setobjt2t(L, luaH_set(L, t, key2tval(old)), gval(old));
+      reinsert(L, t, key2tval(old), gval(old));
   }
   if (nold != dummynode)
     luaM_freearray(L, nold, twoto(oldhsize), Node);  /* free old array */
+#if defined(LUA_USE_PACKED)
+  if (t->sizearray == 0)
+    t->packed = 0;
+  else if (!t->packed)
+    pack(L, t);  /* maybe it holds only numbers now */
+#endif
+  t->border = t->sizearray;  /* search for a boundary from the top */
 }
 
 
 void luaH_resizearray (lua_State *L, Table *t, int nasize) {
-  int nsize = (t->node == dummynode) ? 0 : sizenode(t);
+  int nsize = (t->node == dummynode) ? 0 : maxuse(sizenode(t));
   resize(L, t, nasize, nsize);
 }
 
 
+/*
+** makes room for at least `nasize' elements in the array part and for
+** `nhsize' keys besides the current ones in the hash part, so that
+** filling them does not rehash the table
+*/
+void luaH_reserve (lua_State *L, Table *t, int nasize, int nhsize) {
+  int hsize;
+  int i;
+  finishmove(L, t);  /* all keys must be in the hash part */
+  hsize = (t->node == dummynode) ? 0 : maxuse(sizenode(t));
+  if (nhsize > 0 && nhsize <= MAX_INT - sizenode(t)) {
+    for (i = 0; i < sizenode(t); i++)  /* count keys already there */
+      nhsize += !ttisnil(gval(gnode(t, i)));
+  }
+  if (nasize <= t->sizearray && nhsize <= hsize)
+    return;  /* there is room already */
+  if (nasize < t->sizearray) nasize = t->sizearray;  /* never shrinks */
+  if (nhsize < hsize) nhsize = hsize;
+  resize(L, t, nasize, nhsize);
+}
+
+
 static void rehash (lua_State *L, Table *t, const TValue *ek) {
   int nasize, na;
   int nums[MAXBITS+1];  /* nums[i] = number of keys between 2^(i-1) and 2^i */
   int i;
   int totaluse;
+  finishmove(L, t);  /* count all keys in hash part */
   for (i=0; i<=MAXBITS; i++) nums[i] = 0;  /* reset counts */
   nasize = numusearray(t, nums);  /* count keys in array part */
   totaluse = nasize;  /* all those keys are integer keys */
@@ -355,17 +836,173 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
 */
 
 
+
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+
+/* hash of the shape that adds `key' to shape `p' */
+#define hashshape(p,key)	(IntPoint(p) ^ (key)->tsv.hash)
+
+
+void luaH_initshapes (lua_State *L) {
+  Shape *s;
+  if (LUAI_MAXSHAPE == 0) return;  /* shapes are off */
+  luaH_resizeshapes(L, MINSTRTABSIZE);
+  s = cast(Shape *, luaM_malloc(L, sizeshape(0)));
+  s->nkeys = 0;
+  s->keymask = 0;
+  s->hash = 0;
+  s->parent = NULL;  /* (the only shape not in `shapet') */
+  s->hnext = NULL;
+  luaC_link(L, obj2gco(s), LUA_TSHAPE);
+  l_setbit(s->marked, FIXEDBIT);  /* never collect it */
+  G(L)->shape0 = s;
+}
+
+
+void luaH_resizeshapes (lua_State *L, int newsize) {
+  shapetable *tb = &G(L)->shapet;
+  Shape **newhash = luaM_newvector(L, newsize, Shape *);
+  int i;
+  for (i=0; i<newsize; i++) newhash[i] = NULL;
+  /* rehash */
+  for (i=0; i<tb->size; i++) {
+    Shape *s = tb->hash[i];
+    while (s) {  /* for each node in the list */
+      Shape *next = s->hnext;  /* save next */
+      int h1 = lmod(s->hash, newsize);  /* new position */
+      s->hnext = newhash[h1];  /* chain it */
+      newhash[h1] = s;
+      s = next;
+    }
+  }
+  luaM_freearray(L, tb->hash, tb->size, Shape *);
+  tb->size = newsize;
+  tb->hash = newhash;
+}
+
+
+void luaH_freeshape (lua_State *L, Shape *s) {
+  if (s->parent) {  /* remove it from `shapet' */
+    shapetable *tb = &G(L)->shapet;
+    Shape **p = &tb->hash[lmod(s->hash, tb->size)];
+    while (*p != s) p = &(*p)->hnext;
+    *p = s->hnext;
+    tb->nuse--;
+  }
+  luaM_freemem(L, s, sizeshape(s->nkeys));
+}
+
+
+/*
+** returns the shape with the keys of `s' followed by `key', creating
+** it if no live table has made that transition before
+*/
+static Shape *addkey (lua_State *L, Shape *s, TString *key) {
+  global_State *g = G(L);
+  unsigned int h = hashshape(s, key);
+  Shape *ns;
+  for (ns = g->shapet.hash[lmod(h, g->shapet.size)]; ns; ns = ns->hnext) {
+    /* a dead shape cannot be resurrected: its keys may be freed already */
+    if (ns->parent == s && ns->keys[ns->nkeys - 1] == key &&
+        !isdead(g, obj2gco(ns)))
+      return ns;
+  }
+  ns = cast(Shape *, luaM_malloc(L, sizeshape(s->nkeys + 1)));
+  ns->nkeys = cast_byte(s->nkeys + 1);
+  ns->keymask = s->keymask | keybit(key);
+  ns->hash = h;
+  ns->parent = s;
+  memcpy(ns->keys, s->keys, s->nkeys * sizeof(TString *));
+  ns->keys[s->nkeys] = key;
+  luaC_link(L, obj2gco(ns), LUA_TSHAPE);
+  if (g->shapet.nuse >= cast(lu_int32, g->shapet.size))
+    luaH_resizeshapes(L, g->shapet.size*2);  /* too crowded */
+  h = lmod(h, g->shapet.size);
+  ns->hnext = g->shapet.hash[h];  /* chain new entry */
+  g->shapet.hash[h] = ns;
+  g->shapet.nuse++;
+  return ns;
+}
+
+
+/*
+** gives `key' the next slot of shaped table `t'
+*/
+static TValue *newslot (lua_State *L, Table *t, TString *key) {
+  Shape *s = addkey(L, t->shape, key);
+  if (s->nkeys > t->sizeslots) {  /* slots must grow? */
+    int size = 2*t->sizeslots;
+    if (size < 4) size = 4;
+    if (size > LUAI_MAXSHAPE) size = LUAI_MAXSHAPE;
+    setslotvector(L, t, size);
+  }
+  t->shape = s;
+  luaC_objbarriert(L, t, s);
+  lua_assert(ttisnil(&t->slots[s->nkeys - 1]));
+  return &t->slots[s->nkeys - 1];
+}
+
+
+/*
+** moves the string keys of shaped table `t' to its hash part
+*/
+static void unshape (lua_State *L, Table *t) {
+  Shape *s = t->shape;
+  TValue *slots = t->slots;
+  int size = t->sizeslots;
+  int nuse = 1;  /* count the key that does not fit */
+  int i;
+  finishmove(L, t);
+  for (i = 0; i < s->nkeys; i++)
+    nuse += !ttisnil(&slots[i]);
+  for (i = 0; i < sizenode(t); i++)
+    nuse += !ttisnil(gval(gnode(t, i)));
+  resize(L, t, t->sizearray, nuse);  /* make room for all of them */
+  t->shape = NULL;
+  t->slots = NULL;
+  t->sizeslots = 0;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!ttisnil(&slots[i]))
+      setobjt2t(L, luaH_setstr(L, t, s->keys[i]), &slots[i]);
+  }
+  luaM_freearray(L, slots, size, TValue);
+}
+
+/*
+** }=============================================================
+*/
+
+
 Table *luaH_new (lua_State *L, int narray, int nhash) {
   Table *t = luaM_new(L, Table);
   luaC_link(L, obj2gco(t), LUA_TTABLE);
   t->metatable = NULL;
-  t->flags = cast_byte(~0);
+  t->flags = cast(lu_int32, ~0);
+  t->mcepoch = 0;
   /* temporary values (kept only if some malloc fails) */
   t->array = NULL;
   t->sizearray = 0;
   t->lsizenode = 0;
   t->node = cast(Node *, dummynode);
+  t->shape = NULL;
+  t->slots = NULL;
+  t->sizeslots = 0;
+  t->old = NULL;
+  t->border = narray;
+#if defined(LUA_USE_PACKED)
+  t->packed = (narray > 0);  /* until something else is stored */
+#endif
   setarrayvector(L, t, narray);
+  if (G(L)->shape0 != NULL && nhash <= LUAI_MAXSHAPE) {  /* a record? */
+    setslotvector(L, t, nhash);
+    t->shape = G(L)->shape0;
+    nhash = 0;
+  }
   setnodevector(L, t, nhash);
   return t;
 }
@@ -374,77 +1011,74 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
 void luaH_free (lua_State *L, Table *t) {
   if (t->node != dummynode)
     luaM_freearray(L, t->node, sizenode(t), Node);
+#if defined(LUA_USE_PACKED)
+  if (t->packed)
+    luaM_freearray(L, t->array, t->sizearray, PackedNum);
+  else
+#endif
   luaM_freearray(L, t->array, t->sizearray, TValue);
+  luaM_freearray(L, t->slots, t->sizeslots, TValue);
+  if (t->old) freeold(L, t);
   luaM_free(L, t);
 }
 
 
-static Node *getfreepos (Table *t) {
-  while (t->lastfree-- > t->node) {
-    if (ttisnil(gkey(t->lastfree)))
-      return t->lastfree;
-  }
-  return NULL;  /* could not find a free place */
-}
-
-
-
 /*
-** inserts a new key into a hash table; first, check whether key's main 
-** position is free. If not, check whether colliding node is in its main 
-** position or not: if it is not, move colliding node to an empty place and 
-** put new key in its main position; otherwise (colliding node is in its main 
-** position), new key goes to an empty position. 
+** inserts a key not in the table (see `insertkey' and `newslot')
 */
+static TValue *setslot (lua_State *L, Table *t, const TValue *key);
+
+
 static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp = mainposition(t, key);
-  if (!ttisnil(gval(mp)) || mp == dummynode) {
-    Node *othern;
-    Node *n = getfreepos(t);  /* get a free place */
-    if (n == NULL) {  /* cannot find a free place? */
+  TValue *v;
+  if (t->shape && ttisstring(key)) {  /* string key of a shaped table? */
+    if (t->shape->nkeys < LUAI_MAXSHAPE)
+      return newslot(L, t, rawtsvalue(key));
+    unshape(L, t);  /* too many keys: keep them all in the hash part */
+  }
+  if (t->old) moveold(L, t, INCRSTEP);
+  v = insertkey(L, t, key);
+  if (v == NULL) {  /* no room in hash part? */
+    if (t->old == NULL && sizenode(t) >= MININCR)
+      grow(L, t);  /* let it grow incrementally */
+    else {
       rehash(L, t, key);  /* grow table */
-      return luaH_set(L, t, key);  /* re-insert key into grown table */
-    }
-    lua_assert(n != dummynode);
-    othern = mainposition(t, key2tval(mp));
-    if (othern != mp) {  /* is colliding node out of its main position? */
-      /* yes; move colliding node into free position */
-      while (gnext(othern) != mp) othern = gnext(othern);  /* find previous */
-      gnext(othern) = n;  /* redo the chain with `n' in place of `mp' */
-      *n = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
-      gnext(mp) = NULL;  /* now `mp' is free */
-      setnilvalue(gval(mp));
-    }
-    else {  /* colliding node is in its own main position */
-      /* new node will go into free position */
-      gnext(n) = gnext(mp);  /* chain new position */
-      gnext(mp) = n;
-      mp = n;
+      return setslot(L, t, key);  /* re-insert key into grown table */
     }
+    v = insertkey(L, t, key);
+    lua_assert(v != NULL);
   }
-  gkey(mp)->value = key->value; gkey(mp)->tt = key->tt;
-  luaC_barriert(L, t, key);
-  lua_assert(ttisnil(gval(mp)));
-  return gval(mp);
+  return v;
 }
 
 
 /*
 ** search function for integers
 */
-const TValue *luaH_getnum (Table *t, int key) {
+const TValue *luaH_getnum (Table *t, int key, TValue *tmp) {
   /* (1 <= key && key <= t->sizearray) */
-  if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
+  if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray)) {
+#if defined(LUA_USE_PACKED)
+    if (t->packed) {  /* return a copy of the number */
+      PackedNum *p = pkarray(t) + (key-1);
+      if (pkisnil(p)) return luaO_nilobject;
+      setpknum(tmp, p->n);
+      return tmp;
+    }
+#else
+    UNUSED(tmp);
+#endif
     return &t->array[key-1];
+  }
   else {
     lua_Number nk = cast_num(key);
     Node *n = hashnum(t, nk);
     do {  /* check whether `key' is somewhere in the chain */
       if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
         return gval(n);  /* that's it */
-      else n = gnext(n);
+      else n = probenext(t, n);
     } while (n);
-    return luaO_nilobject;
+    return (t->old) ? luaH_getnum(&t->old->h, key, tmp) : luaO_nilobject;
   }
 }
 
@@ -453,29 +1087,65 @@ const TValue *luaH_getnum (Table *t, int key) {
 ** search function for strings
 */
 const TValue *luaH_getstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
+  if (t->shape) {  /* key must be in a slot */
+    int i = shapeslot(t->shape, key);
+    return (i >= 0) ? &t->slots[i] : luaO_nilobject;
+  }
+  n = hashstr(t, key);
   do {  /* check whether `key' is somewhere in the chain */
     if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
       return gval(n);  /* that's it */
-    else n = gnext(n);
+    else n = probenext(t, n);
   } while (n);
-  return luaO_nilobject;
+  return (t->old) ? luaH_getstr(&t->old->h, key) : luaO_nilobject;
+}
+
+
+/*
+** search function for strings that also records in `slot' the node (or
+** the slot, in a shaped table) where the key was found (for the inline
+** caches of `luaH_getstrc'); keys in the old hash part are not recorded
+*/
+const TValue *luaH_getstrslot (Table *t, TString *key, int *slot) {
+  Node *n;
+  if (t->shape) {  /* key must be in a slot */
+    int i = shapeslot(t->shape, key);
+    if (i < 0) return luaO_nilobject;
+    *slot = i;
+    return &t->slots[i];
+  }
+  n = hashstr(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key) {
+      *slot = cast_int(n - gnode(t, 0));
+      return gval(n);  /* that's it */
+    }
+    else n = probenext(t, n);
+  } while (n);
+  return (t->old) ? luaH_getstr(&t->old->h, key) : luaO_nilobject;
 }
 
 
 /*
 ** main search function
 */
-const TValue *luaH_get (Table *t, const TValue *key) {
+const TValue *luaH_get (Table *t, const TValue *key, TValue *tmp) {
   switch (ttype(key)) {
     case LUA_TNIL: return luaO_nilobject;
     case LUA_TSTRING: return luaH_getstr(t, rawtsvalue(key));
     case LUA_TNUMBER: {
       int k;
-      lua_Number n = nvalue(key);
+      lua_Number n;
+      if (ttisint(key)) {
+        lua_Integer ik = ivalue(key);
+        if (cast(lua_Integer, cast_int(ik)) == ik)
+          return luaH_getnum(t, cast_int(ik), tmp);  /* no conversion */
+      }
+      n = nvalue(key);
       lua_number2int(k, n);
       if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
-        return luaH_getnum(t, k);  /* use specialized version */
+        return luaH_getnum(t, k, tmp);  /* use specialized version */
       /* else go through */
     }
     default: {
@@ -483,17 +1153,28 @@ const TValue *luaH_get (Table *t, const TValue *key) {
       do {  /* check whether `key' is somewhere in the chain */
         if (luaO_rawequalObj(key2tval(n), key))
           return gval(n);  /* that's it */
-        else n = gnext(n);
+        else n = probenext(t, n);
       } while (n);
-      return luaO_nilobject;
+      return (t->old) ? luaH_get(&t->old->h, key, tmp) : luaO_nilobject;
     }
   }
 }
 
 
-TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
-  const TValue *p = luaH_get(t, key);
+/*
+** slot for a primitive set of t[key]; NULL when `key' is in a packed
+** array part (maybe only after the table grew for it)
+*/
+static TValue *setslot (lua_State *L, Table *t, const TValue *key) {
+  const TValue *p;
+  TValue tmp;  /* (not used: packed positions are out) */
   t->flags = 0;
+  luaT_mcwrite(L, t);
+#if defined(LUA_USE_PACKED)
+  if (luaH_packedslot(t, key) >= 0)
+    return NULL;
+#endif
+  p = luaH_get(t, key, &tmp);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
@@ -505,20 +1186,68 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
 }
 
 
+TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
+  TValue *p = setslot(L, t, key);
+#if defined(LUA_USE_PACKED)
+  if (p == NULL) {
+    int n = luaH_packedslot(t, key);
+    unpack(L, t);  /* caller may store anything there */
+    p = &t->array[n];
+  }
+#endif
+  return p;
+}
+
+
+/*
+** t[key] = v, with its barrier; unlike a store through `luaH_set', it
+** keeps a packed array part packed when `v' is a number
+*/
+void luaH_setobj (lua_State *L, Table *t, const TValue *key,
+                  const TValue *v) {
+  TValue *p = setslot(L, t, key);
+#if defined(LUA_USE_PACKED)
+  if (p == NULL) {
+    luaH_setarray(L, t, luaH_packedslot(t, key), v);
+    return;
+  }
+#endif
+  setobj2t(L, p, v);
+  luaC_barriert(L, t, v);
+}
+
+
 TValue *luaH_setnum (lua_State *L, Table *t, int key) {
-  const TValue *p = luaH_getnum(t, key);
+  const TValue *p;
+  TValue tmp;  /* (not used: the array part is unpacked) */
+#if defined(LUA_USE_PACKED)
+  if (t->packed &&
+      cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
+    unpack(L, t);  /* caller may store anything there */
+#endif
+  p = luaH_getnum(t, key, &tmp);
+  luaT_mcwrite(L, t);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
-    return newkey(L, t, &k);
+    TValue *v;
+    setinteger(&k, key);
+    v = newkey(L, t, &k);
+#if defined(LUA_USE_PACKED)
+    if (v == NULL) {  /* went to a packed array part? */
+      unpack(L, t);  /* caller may store anything there */
+      v = &t->array[key-1];
+    }
+#endif
+    return v;
   }
 }
 
 
 TValue *luaH_setstr (lua_State *L, Table *t, TString *key) {
   const TValue *p = luaH_getstr(t, key);
+  luaT_mcwrite(L, t);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
@@ -529,24 +1258,403 @@ TValue *luaH_setstr (lua_State *L, Table *t, TString *key) {
 }
 
 
+/*
+** dst[j] = src[i], for positions outside the array parts
+*/
+static void moveone (lua_State *L, Table *src, int i, Table *dst, int j) {
+  TValue v, k;
+  setobj(L, &v, luaH_getnum(src, i, &v));
+  setinteger(&k, j);
+  luaH_setobj(L, dst, &k, &v);
+}
+
+
+/*
+** dst[t..t+n-1] = src[f..f+n-1], all positions in the array parts
+*/
+static void moveblock (lua_State *L, Table *src, int f, Table *dst, int t,
+                       int n) {
+#if defined(LUA_USE_PACKED)
+  if (src->packed != dst->packed) {  /* (so they are different tables) */
+    int i;
+    for (i = 0; i < n; i++) {
+      TValue v;
+      getarray(L, src, f-1+i, &v);
+      setarray(L, dst, t-1+i, &v);
+    }
+    return;
+  }
+  if (src->packed) {
+    memmove(pkarray(dst) + (t-1), pkarray(src) + (f-1),
+            cast(size_t, n) * sizeof(PackedNum));
+    return;
+  }
+#endif
+  memmove(&dst->array[t-1], &src->array[f-1],
+          cast(size_t, n) * sizeof(TValue));
+  if (src != dst && isblack(obj2gco(dst)))
+    luaC_barrierback(L, dst);  /* one barrier for the whole block */
+}
+
+
+/*
+** dst[t+i] = src[f+i] for i from 0 to e-f, with raw accesses; the ranges
+** may overlap when `src' and `dst' are the same table. Positions in both
+** array parts are moved as blocks, the others one at a time (a store
+** may grow `dst', and then the rest goes as a block).
+*/
+void luaH_move (lua_State *L, Table *src, int f, int e, int t, Table *dst) {
+  int n = e - f + 1;  /* number of elements to move */
+  int i;
+  if (src != dst || t > f) {  /* move from the top */
+    for (i = n - 1; i >= 0; i--) {
+      if (f >= 1 && t >= 1 && f + i <= src->sizearray &&
+          t + i <= dst->sizearray) {  /* all the rest in the array parts? */
+        moveblock(L, src, f, dst, t, i + 1);
+        return;
+      }
+      moveone(L, src, f + i, dst, t + i);
+    }
+  }
+  else {  /* move from the bottom */
+    for (i = 0; i < n; ) {
+      int a = f + i;
+      int b = t + i;
+      if (a >= 1 && b >= 1 && a <= src->sizearray && b <= dst->sizearray) {
+        int k = n - i;  /* move as many as both array parts hold */
+        if (k > src->sizearray - a + 1) k = src->sizearray - a + 1;
+        if (k > dst->sizearray - b + 1) k = dst->sizearray - b + 1;
+        moveblock(L, src, a, dst, b, k);
+        i += k;
+      }
+      else {
+        moveone(L, src, a, dst, b);
+        i++;
+      }
+    }
+  }
+}
+
+
+
+/*
+** Sorting of array parts: a stable merge sort of a vector `a' of `n'
+** elements of type `T' with the order `lt', with `b' (as large as
+** `a') as scratch; runs of SORTRUN elements are sorted by insertion
+** first. `a' ends pointing to the sorted vector, which may be `b'.
+*/
+#define SORTRUN		16
+
+#define mergesort(T,lt,a,b,n) { \
+  T *s_t; int s_w, s_l, s_j, s_k, s_o; \
+  for (s_l = 0; s_l < (n); s_l += SORTRUN) { \
+    int s_h = (s_l + SORTRUN < (n)) ? s_l + SORTRUN : (n); \
+    for (s_j = s_l + 1; s_j < s_h; s_j++) { \
+      T s_x = (a)[s_j]; \
+      for (s_k = s_j; s_k > s_l && lt(s_x, (a)[s_k-1]); s_k--) \
+        (a)[s_k] = (a)[s_k-1]; \
+      (a)[s_k] = s_x; \
+    } \
+  } \
+  for (s_w = SORTRUN; s_w < (n); s_w *= 2) {  /* merge pairs of runs */ \
+    for (s_l = 0; s_l < (n); s_l += 2*s_w) { \
+      int s_m = (s_l + s_w < (n)) ? s_l + s_w : (n); \
+      int s_h = (s_m + s_w < (n)) ? s_m + s_w : (n); \
+      s_j = s_l; s_k = s_m; s_o = s_l; \
+      while (s_j < s_m && s_k < s_h)  /* (the left run wins ties) */ \
+        (b)[s_o++] = lt((a)[s_k], (a)[s_j]) ? (a)[s_k++] : (a)[s_j++]; \
+      while (s_j < s_m) (b)[s_o++] = (a)[s_j++]; \
+      while (s_k < s_h) (b)[s_o++] = (a)[s_k++]; \
+    } \
+    s_t = (a); (a) = (b); (b) = s_t; \
+  } }
+
+#define strlt(x,y)	((x) != (y) && luaV_strcmp(x, y) < 0)
+
+
+static int sortnumbers (lua_State *L, Table *t, int n) {
+  lua_Number *a, *b, *v;
+  int i;
+#if defined(LUA_USE_PACKED)
+  if (t->packed) {
+    v = cast(lua_Number *, pkarray(t));  /* sort it in place */
+    for (i = 0; i < n; i++)
+      if (luai_numisnan(v[i])) return 0;  /* a nil (PK_NIL) or a NaN */
+    a = v;
+    b = luaM_newvector(L, n, lua_Number);
+    mergesort(lua_Number, luai_numlt, a, b, n);
+    if (a != v) {
+      memcpy(v, a, cast(size_t, n) * sizeof(lua_Number));
+      b = a;
+    }
+    luaM_freearray(L, b, n, lua_Number);
+    return 1;
+  }
+#endif
+  for (i = 0; i < n; i++) {
+    if (!ttisnumber(&t->array[i]) || luai_numisnan(nvalue(&t->array[i])))
+      return 0;
+  }
+  v = luaM_newvector(L, 2*n, lua_Number);
+  for (i = 0; i < n; i++)
+    v[i] = nvalue(&t->array[i]);
+  a = v; b = v + n;
+  mergesort(lua_Number, luai_numlt, a, b, n);
+  for (i = 0; i < n; i++)
+    setnumber(&t->array[i], a[i]);
+  luaM_freearray(L, v, 2*n, lua_Number);
+  return 1;
+}
+
+
+static int sortstrings (lua_State *L, Table *t, int n) {
+  TString **v, **a, **b;
+  int i;
+  for (i = 0; i < n; i++)
+    if (!ttisstring(&t->array[i])) return 0;
+  v = luaM_newvector(L, 2*n, TString *);
+  for (i = 0; i < n; i++)
+    v[i] = rawtsvalue(&t->array[i]);
+  a = v; b = v + n;
+  mergesort(TString *, strlt, a, b, n);
+  for (i = 0; i < n; i++)  /* same strings, in another order: no barrier */
+    setsvalue2n(L, &t->array[i], a[i]);
+  luaM_freearray(L, v, 2*n, TString *);
+  return 1;
+}
+
+
+/*
+** sorts t[1..n] with the primitive order (`<' without metamethods), if
+** they are all in the array part and are either all numbers (but NaN)
+** or all strings; returns 0, leaving `t' as it was, otherwise. The sort
+** is stable, which shows only in the order of 0 and -0.
+*/
+static int sortprimitive (lua_State *L, Table *t, int n) {
+  if (n > t->sizearray)
+    return 0;
+  if (!ispacked(t) && ttisstring(&t->array[0]))
+    return sortstrings(L, t, n);
+  else
+    return sortnumbers(L, t, n);
+}
+
+
+/*
+** The general sorts keep the values they work with in stack slots (the
+** `registers' below), so that they are anchored while the order function
+** runs; that function may also change the table, so every access goes
+** through `sortget'/`sortset' by index.
+*/
+#define RORDER		0	/* order function (or nil) */
+#define RPIVOT		1
+#define RX		2
+#define RY		3
+#define RAUX		4	/* scratch table of the merge sort */
+#define NREGS		5
+
+#define reg(L,r,i)	(restorestack(L, r) + (i))
+
+
+static void sortget (lua_State *L, Table *t, int i, ptrdiff_t r, int o) {
+  StkId res = reg(L, r, o);
+  if (cast(unsigned int, i-1) < cast(unsigned int, t->sizearray))
+    getarray(L, t, i-1, res)
+  else
+    setobj2s(L, res, luaH_getnum(t, i, res));
+}
+
+
+static void sortset (lua_State *L, Table *t, int i, ptrdiff_t r, int o) {
+  const TValue *v = reg(L, r, o);
+  if (cast(unsigned int, i-1) < cast(unsigned int, t->sizearray))
+    setarray(L, t, i-1, v)
+  else {
+    TValue k;
+    setinteger(&k, i);
+    luaH_setobj(L, t, &k, v);
+  }
+}
+
+
+/* is register `a' less than register `b'? */
+static int sortlt (lua_State *L, ptrdiff_t r, int a, int b) {
+  StkId f = reg(L, r, RORDER);
+  if (ttisnil(f))
+    return luaV_lessthan(L, f + a, f + b);
+  else {
+    StkId func;
+    luaD_checkstack(L, 3);
+    f = reg(L, r, RORDER);  /* (the stack may have moved) */
+    func = L->top;
+    setobj2s(L, func, f);
+    setobj2s(L, func + 1, f + a);
+    setobj2s(L, func + 2, f + b);
+    L->top = func + 3;
+    luaD_call(L, func, 1);
+    L->top--;
+    return !l_isfalse(L->top);
+  }
+}
+
+
+/* t[i] <-> t[j], with their values in registers `x' and `y' */
+#define sortswap(L,t,i,j,r,x,y) 	(sortset(L, t, i, r, y), sortset(L, t, j, r, x))
+
+
+/*
+** quicksort of t[l..u], as the table library of Lua 5.1 did it (so with
+** the same calls to the order function); based on `Algorithms in
+** MODULA-3', Robert Sedgewick; Addison-Wesley, 1993.
+*/
+static void auxsort (lua_State *L, Table *t, int l, int u, ptrdiff_t r) {
+  while (l < u) {  /* for tail recursion */
+    int i, j;
+    /* sort elements a[l], a[(l+u)/2] and a[u] */
+    sortget(L, t, l, r, RX);
+    sortget(L, t, u, r, RY);
+    if (sortlt(L, r, RY, RX))  /* a[u] < a[l]? */
+      sortswap(L, t, l, u, r, RX, RY);
+    if (u-l == 1) break;  /* only 2 elements */
+    i = (l+u)/2;
+    sortget(L, t, i, r, RX);
+    sortget(L, t, l, r, RY);
+    if (sortlt(L, r, RX, RY))  /* a[i]<a[l]? */
+      sortswap(L, t, i, l, r, RX, RY);
+    else {
+      sortget(L, t, u, r, RY);
+      if (sortlt(L, r, RY, RX))  /* a[u]<a[i]? */
+        sortswap(L, t, i, u, r, RX, RY);
+    }
+    if (u-l == 2) break;  /* only 3 elements */
+    sortget(L, t, i, r, RPIVOT);  /* Pivot */
+    sortget(L, t, u-1, r, RY);
+    sortswap(L, t, i, u-1, r, RPIVOT, RY);
+    /* a[l] <= P == a[u-1] <= a[u], only need to sort from l+1 to u-2 */
+    i = l; j = u-1;
+    for (;;) {  /* invariant: a[l..i] <= P <= a[j..u] */
+      /* repeat ++i until a[i] >= P */
+      for (;;) {
+        sortget(L, t, ++i, r, RX);
+        if (!sortlt(L, r, RX, RPIVOT)) break;
+        if (i>u) luaG_runerror(L, "invalid order function for sorting");
+      }
+      /* repeat --j until a[j] <= P */
+      for (;;) {
+        sortget(L, t, --j, r, RY);
+        if (!sortlt(L, r, RPIVOT, RY)) break;
+        if (j<l) luaG_runerror(L, "invalid order function for sorting");
+      }
+      if (j<i) break;
+      sortswap(L, t, i, j, r, RX, RY);
+    }
+    sortget(L, t, u-1, r, RX);
+    sortget(L, t, i, r, RY);
+    sortswap(L, t, u-1, i, r, RX, RY);  /* swap pivot (a[u-1]) with a[i] */
+    /* a[l..i-1] <= a[i] == P <= a[i+1..u] */
+    /* adjust so that smaller half is in [j..i] and larger one in [l..u] */
+    if (i-l < u-i) {
+      j=l; i=i-1; l=i+2;
+    }
+    else {
+      j=i+1; i=u; u=j-2;
+    }
+    auxsort(L, t, j, i, r);  /* call recursively the smaller one */
+  }  /* repeat the routine for the larger one */
+}
+
+
+/*
+** stable merge sort of t[l..u], using the same positions of the table
+** in register RAUX as scratch
+*/
+static void auxmerge (lua_State *L, Table *t, int l, int u, ptrdiff_t r) {
+  Table *aux;
+  int i, j, k, m;
+  if (u - l < SORTRUN) {  /* insertion sort */
+    for (i = l+1; i <= u; i++) {
+      sortget(L, t, i, r, RX);
+      for (j = i; j > l; j--) {
+        sortget(L, t, j-1, r, RY);
+        if (!sortlt(L, r, RX, RY)) break;
+        sortset(L, t, j, r, RY);
+      }
+      if (j < i) sortset(L, t, j, r, RX);
+    }
+    return;
+  }
+  m = l + (u - l)/2;
+  auxmerge(L, t, l, m, r);
+  auxmerge(L, t, m+1, u, r);
+  sortget(L, t, m, r, RX);
+  sortget(L, t, m+1, r, RY);
+  if (!sortlt(L, r, RY, RX))  /* halves already in order? */
+    return;
+  aux = hvalue(reg(L, r, RAUX));
+  luaH_move(L, t, l, m, l, aux);  /* move the left half out of the way */
+  i = l; j = m+1; k = l;
+  sortget(L, aux, i, r, RX);
+  for (;;) {  /* register RX holds aux[i], RY holds t[j] */
+    if (sortlt(L, r, RY, RX)) {  /* (the left half wins ties) */
+      sortset(L, t, k++, r, RY);
+      if (++j > u) break;
+      sortget(L, t, j, r, RY);
+    }
+    else {
+      sortset(L, t, k++, r, RX);
+      if (++i > m) return;  /* the rest of t[j..u] is in place */
+      sortget(L, aux, i, r, RX);
+    }
+  }
+  luaH_move(L, aux, i, m, k, t);  /* the rest of the left half */
+}
+
+
+/*
+** sorts t[1..n] (raw accesses) with the order function at the top of
+** the stack (a function `lt' such that `lt(a, b)' is true when `a' must
+** come before `b'), or with `<' if that is nil. With `stable' the sort
+** keeps equal elements in their order; it uses a scratch table as large
+** as `t', and an error in the order function may leave `t' with some
+** elements lost and others repeated.
+*/
+void luaH_sort (lua_State *L, Table *t, int n, int stable) {
+  ptrdiff_t r;
+  int i;
+  if (n < 2 || (ttisnil(L->top - 1) && sortprimitive(L, t, n)))
+    return;
+  luaD_checkstack(L, NREGS);
+  r = savestack(L, L->top - 1);
+  for (i = 1; i < NREGS; i++)
+    setnilvalue(L->top++);
+  if (stable) {
+    sethvalue(L, reg(L, r, RAUX), luaH_new(L, n, 0));
+    auxmerge(L, t, 1, n, r);
+  }
+  else
+    auxsort(L, t, 1, n, r);
+  L->top = reg(L, r, 1);  /* leave the order function */
+}
+
 static int unbound_search (Table *t, unsigned int j) {
   unsigned int i = j;  /* i is zero or a present index */
+  TValue tmp;
   j++;
   /* find `i' and `j' such that i is present and j is not */
-  while (!ttisnil(luaH_getnum(t, j))) {
+  while (!ttisnil(luaH_getnum(t, j, &tmp))) {
     i = j;
     j *= 2;
     if (j > cast(unsigned int, MAX_INT)) {  /* overflow? */
       /* table was built with bad purposes: resort to linear search */
       i = 1;
-      while (!ttisnil(luaH_getnum(t, i))) i++;
+      while (!ttisnil(luaH_getnum(t, i, &tmp))) i++;
       return i - 1;
     }
   }
   /* now do a binary search between them */
   while (j - i > 1) {
     unsigned int m = (i+j)/2;
-    if (ttisnil(luaH_getnum(t, m))) j = m;
+    if (ttisnil(luaH_getnum(t, m, &tmp))) j = m;
     else i = m;
   }
   return i;
@@ -554,17 +1662,28 @@ static int unbound_search (Table *t, unsigned int j) {
 
 
 /*
-** Try to find a boundary in table `t'. A `boundary' is an integer index
-** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+** is `j' a boundary of `t'?
 */
-int luaH_getn (Table *t) {
+static int isborder (Table *t, unsigned int j) {
+  TValue tmp;
+  if (j < cast(unsigned int, t->sizearray))  /* `j+1' in the array part? */
+    return arrisnil(t, j) && (j == 0 || !arrisnil(t, j - 1));
+  else if (j >= cast(unsigned int, MAX_INT))
+    return 0;  /* let `findborder' deal with it */
+  else
+    return ttisnil(luaH_getnum(t, j + 1, &tmp)) &&
+           (j == 0 || !ttisnil(luaH_getnum(t, j, &tmp)));
+}
+
+
+static int findborder (Table *t) {
   unsigned int j = t->sizearray;
-  if (j > 0 && ttisnil(&t->array[j - 1])) {
+  if (j > 0 && arrisnil(t, j - 1)) {
     /* there is a boundary in the array part: (binary) search for it */
     unsigned int i = 0;
     while (j - i > 1) {
       unsigned int m = (i+j)/2;
-      if (ttisnil(&t->array[m - 1])) j = m;
+      if (arrisnil(t, m - 1)) j = m;
       else i = m;
     }
     return i;
@@ -576,6 +1695,30 @@ int luaH_getn (Table *t) {
 }
 
 
+/*
+** Try to find a boundary in table `t'. A `boundary' is an integer index
+** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+** `t->border' is the boundary found last time (or the size of the array
+** part, after a resize). It is only a hint (stores do not update it), but
+** appending to or removing from the end of a sequence moves the boundary
+** by one, so it or a neighbour is usually still right and the search is
+** not needed.
+*/
+int luaH_getn (Table *t) {
+  unsigned int j = t->border;
+  if (isborder(t, j))
+    return cast_int(j);
+  else if (isborder(t, j + 1))  /* appended? */
+    j++;
+  else if (j > 0 && isborder(t, j - 1))  /* removed? */
+    j--;
+  else
+    j = findborder(t);
+  t->border = j;
+  return cast_int(j);
+}
+
+
 
 #if defined(LUA_DEBUG)
 
@@ -29,17 +29,108 @@ Gets node following given node in chain of nodes.*/
 #define key2tval(n)	(&(n)->i_key.tvk)
 
 
-LUAI_FUNC const TValue *luaH_getnum (Table *t, int key);
+/* number of string keys kept in the shape of table `t' */
+#define nslots(t)	((t)->shape ? cast_int((t)->shape->nkeys) : 0)
+
+
+/*
+** position `i' of the array part of `t', which may be packed (see
+** ltable.c): `arrisnil' tests it, `getarray' copies it to `o', and
+** `setarray' stores `v' in it (unpacking the array part if `v' is not
+** a number)
+*/
+#if defined(LUA_USE_PACKED)
+
+#define ispacked(t)	((t)->packed)
+#define pkarray(t)	(cast(PackedNum *, (t)->array))
+#define pkisnil(p)	((p)->u == PK_NIL)
+
+/* sets `o' to a number read from a packed array part; only values that
+   fit in an int (but 0, which may be -0) come back as integers */
+#define setpknum(o,x) \
+	{ TValue *p_o=(o); lua_Number p_n=(x); int p_k; \
+	  lua_number2int(p_k, p_n); \
+	  if (luai_numeq(cast_num(p_k), p_n) && p_k != 0) setivalue(p_o, p_k) \
+	  else setnvalue(p_o, p_n); }
+
+#define arrisnil(t,i) \
+	((t)->packed ? pkisnil(pkarray(t) + (i)) : ttisnil(&(t)->array[i]))
+#define getarray(L,t,i,o) \
+	{ if (!(t)->packed) { setobj(L, o, &(t)->array[i]); } \
+	  else if (pkisnil(pkarray(t) + (i))) { setnilvalue(o); } \
+	  else setpknum(o, pkarray(t)[i].n); }
+#define setarray(L,t,i,v) \
+	{ if (!(t)->packed) \
+	    { setobj2t(L, &(t)->array[i], v); luaC_barriert(L, t, v); } \
+	  else if (!ttisnumber(v) || \
+	           (pkarray(t)[i].n = nvalue(v), pkisnil(pkarray(t) + (i)))) \
+	    luaH_setarray(L, t, i, v); }
+
+#else
+
+#define ispacked(t)	0
+#define arrisnil(t,i)	ttisnil(&(t)->array[i])
+#define getarray(L,t,i,o)	setobj(L, o, &(t)->array[i])
+#define setarray(L,t,i,v) \
+	{ setobj2t(L, &(t)->array[i], v); luaC_barriert(L, t, v); }
+
+#endif
+
+
+/*
+** search for a string key through an inline cache `c' (an int holding
+** the index of the node, or of the slot in a shaped table, where `key'
+** was last found). A hit costs one key compare; a key only leaves its
+** node on a rehash or when a colliding key moves it, and never leaves
+** its slot; when it misses, `luaH_getstrslot' refills `c'.
+*/
+#define cachednode(t,c)	gnode(t, *(c))
+#define cachedslot(t,c,key) \
+	(cast(unsigned int, *(c)) < cast(unsigned int, (t)->shape->nkeys) && \
+	 (t)->shape->keys[*(c)] == (key))
+#define luaH_getstrc(t,key,c) \
+	((t)->shape ? \
+	  (cachedslot(t,c,key) ? &(t)->slots[*(c)] : \
+	                         luaH_getstrslot(t, key, c)) : \
+	 (cast(unsigned int, *(c)) < cast(unsigned int, sizenode(t)) && \
+	  ttisstring(gkey(cachednode(t,c))) && \
+	  rawtsvalue(gkey(cachednode(t,c))) == (key)) ? \
+	    gval(cachednode(t,c)) : luaH_getstrslot(t, key, c))
+
+
+/*
+** `luaH_getnum' and `luaH_get' return the slot of `key' in `t', or, for a
+** position in a packed array part, `tmp' filled with a copy of the number
+** there. Either way the result is read-only. A result may thus live only
+** as long as the caller's `tmp': give each result kept alive at the same
+** time its own `tmp'.
+*/
+LUAI_FUNC const TValue *luaH_getnum (Table *t, int key, TValue *tmp);
 LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, int key);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getstrslot (Table *t, TString *key, int *slot);
 LUAI_FUNC TValue *luaH_setstr (lua_State *L, Table *t, TString *key);
-LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
+LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key, TValue *tmp);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
+LUAI_FUNC void luaH_setobj (lua_State *L, Table *t, const TValue *key,
+                            const TValue *v);
 LUAI_FUNC Table *luaH_new (lua_State *L, int narray, int lnhash);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, int nasize);
+LUAI_FUNC void luaH_reserve (lua_State *L, Table *t, int nasize, int nhsize);
+LUAI_FUNC void luaH_move (lua_State *L, Table *src, int f, int e, int t,
+                          Table *dst);
+LUAI_FUNC void luaH_sort (lua_State *L, Table *t, int n, int stable);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC int luaH_nextc (lua_State *L, Table *t, StkId key, int *cursor);
 LUAI_FUNC int luaH_getn (Table *t);
+LUAI_FUNC void luaH_initshapes (lua_State *L);
+LUAI_FUNC void luaH_resizeshapes (lua_State *L, int newsize);
+LUAI_FUNC void luaH_freeshape (lua_State *L, Shape *s);
+#if defined(LUA_USE_PACKED)
+LUAI_FUNC int luaH_packedslot (const Table *t, const TValue *key);
+LUAI_FUNC void luaH_setarray (lua_State *L, Table *t, int n, const TValue *v);
+#endif
 
 
 #if defined(LUA_DEBUG)
@@ -5,6 +5,7 @@
 */
 
 
+#include <limits.h>
 #include <stddef.h>
 
 #define ltablib_c
@@ -87,6 +88,28 @@ static int setn (lua_State *L) {
 }
 
 
+static int tnew (lua_State *L) {
+  int narr = luaL_optint(L, 1, 0);
+  int nrec = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narr >= 0, 1, "invalid size");
+  luaL_argcheck(L, nrec >= 0, 2, "invalid size");
+  lua_createtable(L, narr, nrec);
+  return 1;
+}
+
+
+static int treserve (lua_State *L) {
+  int narr = luaL_optint(L, 2, 0);
+  int nrec = luaL_optint(L, 3, 0);
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_argcheck(L, narr >= 0, 2, "invalid size");
+  luaL_argcheck(L, nrec >= 0, 3, "invalid size");
+  lua_reservetable(L, 1, narr, nrec);
+  lua_pushvalue(L, 1);
+  return 1;
+}
+
+
 static int tinsert (lua_State *L) {
   int e = aux_getn(L, 1) + 1;  /* first empty element */
   int pos;  /* where to insert new element */
@@ -96,12 +119,12 @@ static int tinsert (lua_State *L) {
       break;
     }
     case 3: {
-      int i;
       pos = luaL_checkint(L, 2);  /* 2nd argument is the position */
       if (pos > e) e = pos;  /* `grow' array if necessary */
-      for (i = e; i > pos; i--) {  /* move up elements */
-        lua_rawgeti(L, 1, i-1);
-        lua_rawseti(L, 1, i);  /* t[i] = t[i-1] */
+      else if (pos < e) {  /* move up elements */
+        luaL_argcheck(L, pos > 0 || e - 1 < INT_MAX + pos, 2,
+                      "position out of bounds");
+        lua_rawmove(L, 1, pos, e-1, pos+1, 1);  /* t[pos+1..e] = t[pos..e-1] */
       }
       break;
     }
@@ -122,16 +145,37 @@ static int tremove (lua_State *L) {
    return 0;  /* nothing to remove */
   luaL_setn(L, 1, e - 1);  /* t.n = n-1 */
   lua_rawgeti(L, 1, pos);  /* result = t[pos] */
-  for ( ;pos<e; pos++) {
-    lua_rawgeti(L, 1, pos+1);
-    lua_rawseti(L, 1, pos);  /* t[pos] = t[pos+1] */
-  }
+  if (pos < e)
+    lua_rawmove(L, 1, pos+1, e, pos, 1);  /* t[pos..e-1] = t[pos+1..e] */
   lua_pushnil(L);
   lua_rawseti(L, 1, e);  /* t[e] = nil */
   return 1;
 }
 
 
+/*
+** table.move (a1, f, e, t [,a2]): a2[t..t+e-f] = a1[f..e], with raw
+** accesses like the other functions here; returns a2 (which is a1 by
+** default)
+*/
+static int tmove (lua_State *L) {
+  int f = luaL_checkint(L, 2);
+  int e = luaL_checkint(L, 3);
+  int t = luaL_checkint(L, 4);
+  int tt = !lua_isnoneornil(L, 5) ? 5 : 1;  /* destination table */
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, tt, LUA_TTABLE);
+  if (e >= f) {  /* otherwise, nothing to move */
+    luaL_argcheck(L, f > 0 || e < INT_MAX + f, 3,
+                  "too many elements to move");
+    luaL_argcheck(L, t <= INT_MAX - (e - f), 4, "destination wrap around");
+    lua_rawmove(L, 1, f, e, t, tt);
+  }
+  lua_pushvalue(L, tt);  /* return destination table */
+  return 1;
+}
+
+
 static void addfield (lua_State *L, luaL_Buffer *b, int i) {
   lua_rawgeti(L, 1, i);
   if (!lua_isstring(L, -1))
@@ -163,108 +207,19 @@ static int tconcat (lua_State *L) {
 
 
 /*
-** {======================================================
-** Quicksort
-** (based on `Algorithms in MODULA-3', Robert Sedgewick;
-**  Addison-Wesley, 1993.)
+** the sort itself is in the core (see `lua_sort'): a quicksort, or a
+** merge sort when `stable' is true, with no API calls per comparison
 */
-
-
-static void set2 (lua_State *L, int i, int j) {
-  lua_rawseti(L, 1, i);
-  lua_rawseti(L, 1, j);
-}
-
-static int sort_comp (lua_State *L, int a, int b) {
-  if (!lua_isnil(L, 2)) {  /* function? */
-    int res;
-    lua_pushvalue(L, 2);
-    lua_pushvalue(L, a-1);  /* -1 to compensate function */
-    lua_pushvalue(L, b-2);  /* -2 to compensate function and `a' */
-    lua_call(L, 2, 1);
-    res = lua_toboolean(L, -1);
-    lua_pop(L, 1);
-    return res;
-  }
-  else  /* a < b? */
-    return lua_lessthan(L, a, b);
-}
-
-static void auxsort (lua_State *L, int l, int u) {
-  while (l < u) {  /* for tail recursion */
-    int i, j;
-    /* sort elements a[l], a[(l+u)/2] and a[u] */
-    lua_rawgeti(L, 1, l);
-    lua_rawgeti(L, 1, u);
-    if (sort_comp(L, -1, -2))  /* a[u] < a[l]? */
-      set2(L, l, u);  /* swap a[l] - a[u] */
-    else
-      lua_pop(L, 2);
-    if (u-l == 1) break;  /* only 2 elements */
-    i = (l+u)/2;
-    lua_rawgeti(L, 1, i);
-    lua_rawgeti(L, 1, l);
-    if (sort_comp(L, -2, -1))  /* a[i]<a[l]? */
-      set2(L, i, l);
-    else {
-      lua_pop(L, 1);  /* remove a[l] */
-      lua_rawgeti(L, 1, u);
-      if (sort_comp(L, -1, -2))  /* a[u]<a[i]? */
-        set2(L, i, u);
-      else
-        lua_pop(L, 2);
-    }
-    if (u-l == 2) break;  /* only 3 elements */
-    lua_rawgeti(L, 1, i);  /* Pivot */
-    lua_pushvalue(L, -1);
-    lua_rawgeti(L, 1, u-1);
-    set2(L, i, u-1);
-    /* a[l] <= P == a[u-1] <= a[u], only need to sort from l+1 to u-2 */
-    i = l; j = u-1;
-    for (;;) {  /* invariant: a[l..i] <= P <= a[j..u] */
-      /* repeat ++i until a[i] >= P */
-      while (lua_rawgeti(L, 1, ++i), sort_comp(L, -1, -2)) {
-        if (i>u) luaL_error(L, "invalid order function for sorting");
-        lua_pop(L, 1);  /* remove a[i] */
-      }
-      /* repeat --j until a[j] <= P */
-      while (lua_rawgeti(L, 1, --j), sort_comp(L, -3, -1)) {
-        if (j<l) luaL_error(L, "invalid order function for sorting");
-        lua_pop(L, 1);  /* remove a[j] */
-      }
-      if (j<i) {
-        lua_pop(L, 3);  /* pop pivot, a[i], a[j] */
-        break;
-      }
-      set2(L, i, j);
-    }
-    lua_rawgeti(L, 1, u-1);
-    lua_rawgeti(L, 1, i);
-    set2(L, u-1, i);  /* swap pivot (a[u-1]) with a[i] */
-    /* a[l..i-1] <= a[i] == P <= a[i+1..u] */
-    /* adjust so that smaller half is in [j..i] and larger one in [l..u] */
-    if (i-l < u-i) {
-      j=l; i=i-1; l=i+2;
-    }
-    else {
-      j=i+1; i=u; u=j-2;
-    }
-    auxsort(L, j, i);  /* call recursively the smaller one */
-  }  /* repeat the routine for the larger one */
-}
-
 static int sort (lua_State *L) {
   int n = aux_getn(L, 1);
-  luaL_checkstack(L, 40, "");  /* assume array is smaller than 2^40 */
+  int stable = lua_toboolean(L, 3);
   if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
     luaL_checktype(L, 2, LUA_TFUNCTION);
-  lua_settop(L, 2);  /* make sure there is two arguments */
-  auxsort(L, 1, n);
+  lua_settop(L, 2);  /* order function (or nil) on top */
+  lua_sort(L, 1, n, stable);
   return 0;
 }
 
-/* }====================================================== */
-
 
 static const luaL_Reg tab_funcs[] = {
   {"concat", tconcat},
@@ -272,6 +227,9 @@ static const luaL_Reg tab_funcs[] = {
   {"foreachi", foreachi},
   {"getn", getn},
   {"maxn", maxn},
+  {"move", tmove},
+  {"new", tnew},
+  {"reserve", treserve},
   {"insert", tinsert},
   {"remove", tremove},
   {"setn", setn},
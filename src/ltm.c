@@ -49,15 +49,31 @@ void luaT_init (lua_State *L) {
 */
 const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
   const TValue *tm = luaH_getstr(events, ename);
-  lua_assert(event <= TM_EQ);
+  lua_assert(event < TM_N);
   if (ttisnil(tm)) {  /* no tag method? */
-    events->flags |= cast_byte(1u<<event);  /* cache this fact */
+    events->flags |= tmbit(event);  /* cache this fact */
     return NULL;
   }
   else return tm;
 }
 
 
+/*
+** invalidate all method-cache entries by starting a new epoch
+*/
+void luaT_mcflush (lua_State *L) {
+  global_State *g = G(L);
+  if (++g->mcepoch == 0) {  /* wrapped around? */
+    int i;
+    for (i = 0; i < MCACHESIZE; i++) {  /* old entries could match again */
+      g->mcache[i].mt = NULL;
+      g->mcache[i].epoch = 0;
+    }
+    g->mcepoch = 1;
+  }
+}
+
+
 const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
   Table *mt;
   switch (ttype(o)) {
@@ -70,7 +86,11 @@ const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
     default:
       mt = G(L)->mt[ttype(o)];
   }
-  return (mt ? luaH_getstr(mt, G(L)->tmname[event]) : luaO_nilobject);
+  if (mt != NULL) {  /* absent events cost a bit test (see `fasttm') */
+    const TValue *tm = fasttm(L, mt, event);
+    if (tm != NULL) return tm;
+  }
+  return luaO_nilobject;
 }
 
 
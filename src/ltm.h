@@ -20,7 +20,7 @@ typedef enum {
   TM_NEWINDEX,
   TM_GC,
   TM_MODE,
-  TM_EQ,  /* last tag method with `fast' access */
+  TM_EQ,
   TM_ADD,
   TM_SUB,
   TM_MUL,
@@ -38,11 +38,40 @@ typedef enum {
 
 
 
+/*
+** every event has a bit in the `flags' of a metatable, set when the
+** event is known to be absent; any write to the table clears them all
+*/
+#define tmbit(e)	(cast(lu_int32, 1) << (e))
+
 #define gfasttm(g,et,e) ((et) == NULL ? NULL : \
-  ((et)->flags & (1u<<(e))) ? NULL : luaT_gettm(et, e, (g)->tmname[e]))
+  ((et)->flags & tmbit(e)) ? NULL : luaT_gettm(et, e, (g)->tmname[e]))
 
 #define fasttm(l,et,e)	gfasttm(G(l), et, e)
 
+
+/*
+** method cache: results of `__index' chain lookups keyed by
+** (metatable, key). Every table visited by a cached lookup is stamped
+** with the current epoch; writing to such a table starts a new epoch,
+** which invalidates the whole cache at once.
+*/
+#define MCACHESIZE	256  /* must be a power of 2 */
+
+typedef struct MCache {
+  Table *mt;
+  TString *key;
+  unsigned int epoch;
+  TValue val;
+} MCache;
+
+#define luaT_mcslot(g,mt,key) \
+	(&(g)->mcache[(IntPoint(mt) ^ (key)->tsv.hash) & (MCACHESIZE-1)])
+
+/* to be called before any change to the contents or metatable of `t' */
+#define luaT_mcwrite(L,t) \
+	{ if ((t)->mcepoch == G(L)->mcepoch) luaT_mcflush(L); }
+
 LUAI_DATA const char *const luaT_typenames[];
 
 
@@ -50,6 +79,7 @@ LUAI_FUNC const TValue *luaT_gettm (Table *events, TMS event, TString *ename);
 LUAI_FUNC const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o,
                                                        TMS event);
 LUAI_FUNC void luaT_init (lua_State *L);
+LUAI_FUNC void luaT_mcflush (lua_State *L);
 
 #endif
 
@@ -197,7 +197,9 @@ LUA_API void  (lua_gettable) (lua_State *L, int idx);
 LUA_API void  (lua_getfield) (lua_State *L, int idx, const char *k);
 LUA_API void  (lua_rawget) (lua_State *L, int idx);
 LUA_API void  (lua_rawgeti) (lua_State *L, int idx, int n);
+LUA_API void  (lua_rawunpack) (lua_State *L, int idx, int i, int j);
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
+LUA_API void  (lua_reservetable) (lua_State *L, int idx, int narr, int nrec);
 LUA_API void *(lua_newuserdata) (lua_State *L, size_t sz);
 LUA_API int   (lua_getmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_getfenv) (lua_State *L, int idx);
@@ -210,6 +212,9 @@ LUA_API void  (lua_settable) (lua_State *L, int idx);
 LUA_API void  (lua_setfield) (lua_State *L, int idx, const char *k);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, int n);
+LUA_API void  (lua_rawmove) (lua_State *L, int from, int f, int e, int t,
+                                           int to);
+LUA_API void  (lua_sort) (lua_State *L, int idx, int n, int stable);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API int   (lua_setfenv) (lua_State *L, int idx);
 
@@ -249,6 +254,20 @@ LUA_API int  (lua_status) (lua_State *L);
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** trace compiler function and options
+*/
+
+#define LUA_JITOFF		0
+#define LUA_JITON		1
+#define LUA_JITFLUSH		2
+#define LUA_JITSTATUS		3
+#define LUA_JITCOUNT		4
+#define LUA_JITFUNCS		5
+
+LUA_API int (lua_jit) (lua_State *L, int what);
+
+
 /*
 ** miscellaneous functions
 */
@@ -7,6 +7,7 @@ Note: Comments based on Lua 5.2.0-alpha.*/
 ** See Copyright Notice in lua.h
 */
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,8 +31,10 @@ Note: Comments based on Lua 5.2.0-alpha.*/
 #define	OUTPUT		PROGNAME ".out"	/* default output file */
 
 static int listing=0;			/* list bytecodes? */
+static int fusion=0;			/* count fused instructions? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int ccoding=0;			/* write C code? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -64,6 +67,8 @@ static void usage(const char* message)
  "usage: %s [options] [filenames].\n"
  "Available options are:\n"
  "  -        process stdin\n"
+ "  -C       write C code for a module named after the output file\n"
+ "  -f       count fused instruction pairs\n"
  "  -l       list\n"
  "  -o name  output to file " LUA_QL("name") " (default is \"%s\")\n"
  "  -p       parse only\n"
@@ -95,6 +100,10 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-C"))			/* write C code */
+   ccoding=1;
+  else if (IS("-f"))			/* count fused instructions */
+   fusion=1;
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -112,7 +121,7 @@ static int doargs(int argc, char* argv[])
   else					/* unknown option */
    usage(argv[i]);
  }
- if (i==argc && (listing || !dumping))
+ if (i==argc && (listing || fusion || !dumping))
  {
   dumping=0;
   argv[--i]=Output;
@@ -160,6 +169,21 @@ static const Proto* combine(lua_State* L, int n)
  }
 }
 
+/*# Name of the C module written with -C: the base name of the
+output file up to its first dot, made into a C identifier.*/
+static const char* modname(void)
+{
+ static char name[64];
+ const char* s=(output==NULL) ? PROGNAME : output;
+ const char* p=strrchr(s,'/');
+ size_t i;
+ if (p!=NULL) s=p+1;
+ for (i=0; i<sizeof(name)-1 && s[i]!=0 && s[i]!='.'; i++)
+  name[i]=isalnum((unsigned char)s[i]) ? s[i] : '_';
+ name[i]=0;
+ return name;
+}
+
 /*# lua_Writer function used to dump generated bytecode to a file.*/
 static int writer(lua_State* L, const void* p, size_t size, void* u)
 {
@@ -188,13 +212,19 @@ static int pmain(lua_State* L)
  }
  f=combine(L,argc);
  if (listing) luaU_print(f,listing>1);
+ if (fusion) luaU_fusion(f);
  if (dumping)
  {
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
-  lua_lock(L);
-  luaU_dump(L,f,writer,D,stripping);
-  lua_unlock(L);
+  if (ccoding)
+   luaU_ccode(L,f,D,modname(),stripping);
+  else
+  {
+   lua_lock(L);
+   luaU_dump(L,f,writer,D,stripping);
+   lua_unlock(L);
+  }
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
  }
@@ -482,6 +482,14 @@
 #define LUAI_MAXUPVALUES	60
 
 
+/*
+@@ LUAI_MAXSHAPE is the maximum number of string keys a table keeps in
+@* a shared shape before moving them to its hash part (must be smaller
+@* than 256). Set it to 0 to keep every key in the hash part.
+*/
+#define LUAI_MAXSHAPE		16
+
+
 /*
 @@ LUAL_BUFFERSIZE is the buffer size used by the lauxlib buffer system.
 */
@@ -582,9 +590,86 @@ union luai_Cast { double l_d; long l_l; };
 
 #endif
 
+
+/*
+@@ LUAI_MAXINT is the largest magnitude of the numbers kept internally
+@* as integers (see LUA_TINT in lobject.h).
+@@ LUAI_MAXFACTOR is the square root of LUAI_MAXINT.
+** CHANGE them if you change LUA_NUMBER or LUA_INTEGER: the sum of two
+** such integers must be exact both as a lua_Number and as a lua_Integer.
+*/
+#if LONG_MAX > 2147483647L
+#define LUAI_MAXINT	(((lua_Integer)1) << 52)
+#define LUAI_MAXFACTOR	(((lua_Integer)1) << 26)
+#else
+#define LUAI_MAXINT	(((lua_Integer)1) << 30)
+#define LUAI_MAXFACTOR	(((lua_Integer)1) << 15)
+#endif
+
+
+/*
+@@ LUA_NANBOX packs the type tag of each value into the unused NaNs of a
+@* double, so that a TValue takes 8 bytes instead of 16 (see lobject.h).
+** CHANGE it (define it) to halve the memory of stacks and tables, if
+** your machine has 64-bit longs and its user-space pointers (including
+** those given as light userdata) fit in 47 bits, as on x86-64 and ARM64.
+** Numbers are then never kept as integers, and the JIT is not used.
+*/
+/* #define LUA_NANBOX */
+
+
+/*
+@@ LUA_OPENHASH keeps the hash part of tables in an open-addressing
+@* table instead of a chained scatter table (see ltable.c).
+** CHANGE it (define it) to trade memory (the hash part is kept at most
+** half full) for searches that walk adjacent positions instead of
+** following chains.
+*/
+/* #define LUA_OPENHASH */
+
+
+/*
+@@ LUA_USE_PACKED keeps the array part of a table that holds only
+@* numbers as a vector of numbers, without their type tags (see ltable.c).
+** CHANGE it (define LUA_NOPACKED) to keep every array part as a vector
+** of tagged values. It needs double numbers and 64-bit longs, and it is
+** never used with LUA_NANBOX, whose values are that small already.
+*/
+#if defined(LUA_NUMBER_DOUBLE) && LONG_MAX > 2147483647L && \
+    !defined(LUA_NANBOX) && !defined(LUA_NOPACKED)
+#define LUA_USE_PACKED
+#endif
+
 /* }================================================================== */
 
 
+/*
+@@ LUA_USE_JUMPTABLE controls the use of computed gotos (a GNU C
+@* extension, "labels as values") to dispatch instructions in the
+@* interpreter main loop.
+** CHANGE it (define LUA_NOJUMPTABLE) if your compiler claims to be GCC
+** but does not support that extension, or if you want the portable
+** `switch' dispatch. It is never used with LUA_ANSI.
+*/
+#if defined(__GNUC__) && !defined(LUA_ANSI) && !defined(LUA_NOJUMPTABLE)
+#define LUA_USE_JUMPTABLE
+#endif
+
+
+/*
+@@ LUA_USE_JIT controls the trace compiler, which translates hot numeric
+@* `for' loops to machine code. It needs an x86-64 processor and a system
+@* with `mmap' (see ljit.c).
+** CHANGE it (define LUA_NOJIT) if your system does not allow mapping
+** executable memory. It is never used with LUA_ANSI or LUA_NANBOX.
+*/
+#if defined(__GNUC__) && defined(__x86_64__) && \
+    (defined(__unix__) || defined(__APPLE__)) && \
+    !defined(LUA_ANSI) && !defined(LUA_NOJIT) && !defined(LUA_NANBOX)
+#define LUA_USE_JIT
+#endif
+
+
 /*
 @@ LUAI_USER_ALIGNMENT_T is a type that requires maximum alignment.
 ** CHANGE it if your system requires alignments larger than double. (For
@@ -39,11 +39,22 @@ LUALIB_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUALIB_API int (luaopen_package) (lua_State *L);
 
+#define LUA_JITLIBNAME	"jit"
+LUALIB_API int (luaopen_jit) (lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
 
 
+#if defined(LUA_CORE) || defined(LUA_LIB)
+/* base library functions that the VM runs in place; from lapi.c */
+LUAI_FUNC int (luaA_select) (lua_State *L);
+LUAI_FUNC int (luaA_next) (lua_State *L);
+LUAI_FUNC int (luaA_inext) (lua_State *L);
+#endif
+
+
 
 #ifndef lua_assert
 #define lua_assert(x)	((void)0)
@@ -11,6 +11,7 @@
 
 #include "lua.h"
 
+#include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -93,6 +94,7 @@ static void LoadCode(LoadState* S, Proto* f)
  f->code=luaM_newvector(S->L,n,Instruction);
  f->sizecode=n;
  LoadVector(S,f->code,n,sizeof(Instruction));
+ luaF_newcache(S->L,f);
 }
 
 static Proto* LoadFunction(LoadState* S, TString* p);
@@ -117,7 +119,7 @@ static void LoadConstants(LoadState* S, Proto* f)
    	setbvalue(o,LoadChar(S)!=0);
 	break;
    case LUA_TNUMBER:
-	setnvalue(o,LoadNumber(S));
+	setnumber(o,LoadNumber(S));
 	break;
    case LUA_TSTRING:
 	setsvalue2n(S->L,o,LoadString(S));
@@ -175,6 +177,7 @@ static Proto* LoadFunction(LoadState* S, TString* p)
  LoadConstants(S,f);
  LoadDebug(S,f);
  IF (!luaG_checkcode(f), "bad code");
+ luaK_fuse(f);
  S->L->top--;
  S->L->nCcalls--;
  return f;
@@ -22,6 +22,12 @@ LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data,
 #ifdef luac_c
 /* print one chunk; from print.c */
 LUAI_FUNC void luaU_print (const Proto* f, int full);
+
+/* count fused instruction pairs; from print.c */
+LUAI_FUNC void luaU_fusion (const Proto* f);
+
+/* write one chunk as C code; from ccode.c */
+LUAI_FUNC void luaU_ccode (lua_State* L, const Proto* f, FILE* D, const char* name, int strip);
 #endif
 
 /* for header of binary files -- this is Lua 5.1 */
@@ -13,11 +13,13 @@
 #define LUA_CORE
 
 #include "lua.h"
+#include "lualib.h"
 
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -111,7 +113,8 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
     const TValue *tm;
     if (ttistable(t)) {  /* `t' is a table? */
       Table *h = hvalue(t);
-      const TValue *res = luaH_get(h, key); /* do a primitive get */
+      TValue tmp;
+      const TValue *res = luaH_get(h, key, &tmp); /* do a primitive get */
       if (!ttisnil(res) ||  /* result is no nil? */
           (tm = fasttm(L, h->metatable, TM_INDEX)) == NULL) { /* or no TM? */
         setobj2s(L, val, res);
@@ -131,6 +134,43 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
 }
 
 
+/*
+** lookup of `key' through the `__index' chain of metatable `mt', using
+** the method cache. Returns NULL when the chain cannot be cached (no
+** `__index' at all, a function handler, or a loop); then the caller
+** must go through `luaV_gettable'.
+*/
+const TValue *luaV_getmethod (lua_State *L, Table *mt, TString *key) {
+  global_State *g = G(L);
+  MCache *mc = luaT_mcslot(g, mt, key);
+  Table *h = mt;
+  const TValue *res = luaO_nilobject;
+  int loop;
+  if (mc->mt == mt && mc->key == key && mc->epoch == g->mcepoch)
+    return &mc->val;  /* cache hit */
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *tm = gfasttm(g, h, TM_INDEX);
+    h->mcepoch = g->mcepoch;  /* result depends on this metatable */
+    if (tm == NULL) {
+      if (h == mt) return NULL;
+      break;  /* end of chain; result is nil */
+    }
+    if (!ttistable(tm)) return NULL;
+    h = hvalue(tm);
+    h->mcepoch = g->mcepoch;  /* ...and on this table */
+    res = luaH_getstr(h, key);
+    if (!ttisnil(res) || h->metatable == NULL) break;
+    h = h->metatable;  /* else repeat with its metatable */
+  }
+  if (loop == MAXTAGLOOP) return NULL;
+  mc->mt = mt;
+  mc->key = key;
+  mc->epoch = g->mcepoch;
+  setobj(L, &mc->val, res);
+  return &mc->val;
+}
+
+
 void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;
   TValue temp;
@@ -138,7 +178,12 @@ void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
     const TValue *tm;
     if (ttistable(t)) {  /* `t' is a table? */
       Table *h = hvalue(t);
-      TValue *oldval = luaH_set(L, h, key); /* do a primitive set */
+      TValue *oldval;
+      if (fasttm(L, h->metatable, TM_NEWINDEX) == NULL) {  /* no TM? */
+        luaH_setobj(L, h, key, val);  /* do a primitive set */
+        return;
+      }
+      oldval = luaH_set(L, h, key); /* do a primitive set */
       if (!ttisnil(oldval) ||  /* result is no nil? */
           (tm = fasttm(L, h->metatable, TM_NEWINDEX)) == NULL) { /* or no TM? */
         setobj2t(L, oldval, val);
@@ -200,7 +245,7 @@ static int call_orderTM (lua_State *L, const TValue *p1, const TValue *p2,
 }
 
 
-static int l_strcmp (const TString *ls, const TString *rs) {
+int luaV_strcmp (const TString *ls, const TString *rs) {
   const char *l = getstr(ls);
   size_t ll = ls->tsv.len;
   const char *r = getstr(rs);
@@ -222,28 +267,36 @@ static int l_strcmp (const TString *ls, const TString *rs) {
 }
 
 
+/* order of two numbers */
+#define numlt(rb,rc)	(ttisint(rb) && ttisint(rc) ? \
+	ivalue(rb) < ivalue(rc) : luai_numlt(nvalue(rb), nvalue(rc)))
+
+#define numle(rb,rc)	(ttisint(rb) && ttisint(rc) ? \
+	ivalue(rb) <= ivalue(rc) : luai_numle(nvalue(rb), nvalue(rc)))
+
+
 int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
-    return luai_numlt(nvalue(l), nvalue(r));
+    return numlt(l, r);
   else if (ttisstring(l))
-    return l_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
+    return luaV_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
   else if ((res = call_orderTM(L, l, r, TM_LT)) != -1)
     return res;
   return luaG_ordererror(L, l, r);
 }
 
 
-static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
+int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
-    return luai_numle(nvalue(l), nvalue(r));
+    return numle(l, r);
   else if (ttisstring(l))
-    return l_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
+    return luaV_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
   else if ((res = call_orderTM(L, l, r, TM_LE)) != -1)  /* first try `le' */
     return res;
   else if ((res = call_orderTM(L, r, l, TM_LT)) != -1)  /* else try `lt' */
@@ -315,12 +368,178 @@ void luaV_concat (lua_State *L, int total, int last) {
 }
 
 
-static void Arith (lua_State *L, StkId ra, const TValue *rb,
-                   const TValue *rc, TMS op) {
+static int tointeger (const TValue *o, lua_Integer *i) {
+  if (ttisint(o)) {
+    *i = ivalue(o);
+    return 1;
+  }
+  return luaO_toint(nvalue(o), i);
+}
+
+
+/*
+** Prepares the numeric `for' loop at `ra', checking its values and
+** subtracting the step from the initial value. When the three values are
+** integers the loop counts with integers, which gives the same indices
+** (all sums stay within 2*LUAI_MAXINT, which is exact); otherwise they
+** all become numbers. OP_FORLOOP tells one case from the other by the
+** type of the index.
+*/
+void luaV_forprep (lua_State *L, StkId ra) {
+  const TValue *init = ra;
+  const TValue *plimit = ra+1;
+  const TValue *pstep = ra+2;
+  lua_Integer i, l, s;
+  if (!tonumber(init, ra))
+    luaG_runerror(L, LUA_QL("for") " initial value must be a number");
+  else if (!tonumber(plimit, ra+1))
+    luaG_runerror(L, LUA_QL("for") " limit must be a number");
+  else if (!tonumber(pstep, ra+2))
+    luaG_runerror(L, LUA_QL("for") " step must be a number");
+  if (tointeger(init, &i) && tointeger(plimit, &l) && tointeger(pstep, &s)) {
+    setivalue(ra, i - s);
+    setivalue(ra+1, l);
+    setivalue(ra+2, s);
+  }
+  else {
+    lua_Number step = nvalue(pstep);
+    setnvalue(ra+1, nvalue(plimit));
+    setnvalue(ra+2, step);
+    setnvalue(ra, luai_numsub(nvalue(init), step));
+  }
+}
+
+
+/* `o' is the C function `fn' */
+#define iscfunc(o,fn) \
+	(ttisfunction(o) && clvalue(o)->c.isC && clvalue(o)->c.f == (fn))
+
+
+/*
+** One step of the generic `for' at `ra' when its iterator is `next' or
+** the iterator of `ipairs' from the base library: puts the results in
+** R(A+3), ... without calling it. `next' keeps the position of the key
+** in `cursor' (see `luaH_nextc'). Returns 0, doing nothing, when the
+** iterator has to be called.
+*/
+int luaV_tforstep (lua_State *L, StkId ra, int nvars, int *cursor) {
+  StkId cb = ra + 3;
+  int n;  /* number of results */
+  if (!ttistable(ra+1) || (L->hookmask & (LUA_MASKCALL | LUA_MASKRET)))
+    return 0;
+  if (iscfunc(ra, luaA_next)) {
+    setobjs2s(L, cb, ra+2);
+    n = luaH_nextc(L, hvalue(ra+1), cb, cursor);
+    if (n < 0)  /* invalid key: let `next' raise the error */
+      return 0;
+    n *= 2;
+  }
+  else if (iscfunc(ra, luaA_inext) && ttisnumber(ra+2)) {
+    int k;
+    lua_Number nk = nvalue(ra+2);
+    const TValue *v;
+    TValue tmp;
+    lua_number2int(k, nk);
+    if (cast_num(k) != nk || k >= MAX_INT)
+      return 0;
+    v = luaH_getnum(hvalue(ra+1), k + 1, &tmp);
+    if (ttisnil(v))
+      n = 0;
+    else {
+      setivalue(cb, k + 1);
+      setobj2s(L, cb+1, v);
+      n = 2;
+    }
+  }
+  else return 0;
+  for (; n < nvars; n++)  /* complete missing results */
+    setnilvalue(cb + n);
+  return 1;
+}
+
+
+/*
+** Arithmetic on integers. A result within LUAI_MAXINT stays an integer;
+** it equals the result of the arithmetic on numbers, which is what the
+** other results get. Large products are computed as numbers (exact for
+** them), and so are zero ones, so that a zero product with a negative
+** factor is -0, a number.
+*/
+static void intadd (TValue *ra, lua_Integer a, lua_Integer b) {
+  setinteger(ra, a + b);
+}
+
+
+static void intsub (TValue *ra, lua_Integer a, lua_Integer b) {
+  setinteger(ra, a - b);
+}
+
+
+#define smallfactor(x) \
+  (cast(size_t, (x) + LUAI_MAXFACTOR) <= cast(size_t, 2*LUAI_MAXFACTOR))
+
+static void intmul (TValue *ra, lua_Integer a, lua_Integer b) {
+  if (smallfactor(a) && smallfactor(b) && a != 0 && b != 0) {
+    setivalue(ra, a * b);
+  }
+  else {
+    setnumber(ra, luai_nummul(cast_num(a), cast_num(b)));
+  }
+}
+
+
+static void intdiv (TValue *ra, lua_Integer a, lua_Integer b) {
+  setnvalue(ra, luai_numdiv(cast_num(a), cast_num(b)));
+}
+
+
+static void intmod (TValue *ra, lua_Integer a, lua_Integer b) {
+  if (b == 0) {
+    setnvalue(ra, luai_nummod(cast_num(a), cast_num(b)));  /* NaN */
+  }
+  else {
+    lua_Integer r = a % b;
+    if (r != 0 && (r ^ b) < 0) r += b;  /* result has the sign of `b' */
+    setivalue(ra, r);
+  }
+}
+
+
+static void intpow (TValue *ra, lua_Integer a, lua_Integer b) {
+  setnvalue(ra, luai_numpow(cast_num(a), cast_num(b)));
+}
+
+
+static void intunm (TValue *ra, lua_Integer a) {
+  if (a != 0) {
+    setivalue(ra, -a);
+  }
+  else {
+    setnvalue(ra, luai_numunm(cast_num(a)));  /* -0 */
+  }
+}
+
+
+void luaV_arith (lua_State *L, StkId ra, const TValue *rb,
+                 const TValue *rc, TMS op) {
   TValue tempb, tempc;
   const TValue *b, *c;
   if ((b = luaV_tonumber(rb, &tempb)) != NULL &&
-      (c = luaV_tonumber(rc, &tempc)) != NULL) {
+      (c = luaV_tonumber(rc, &tempc)) != NULL &&
+      ttisint(b) && ttisint(c)) {
+    lua_Integer ib = ivalue(b), ic = ivalue(c);
+    switch (op) {
+      case TM_ADD: intadd(ra, ib, ic); break;
+      case TM_SUB: intsub(ra, ib, ic); break;
+      case TM_MUL: intmul(ra, ib, ic); break;
+      case TM_DIV: intdiv(ra, ib, ic); break;
+      case TM_MOD: intmod(ra, ib, ic); break;
+      case TM_POW: intpow(ra, ib, ic); break;
+      case TM_UNM: intunm(ra, ib); break;
+      default: lua_assert(0); break;
+    }
+  }
+  else if (b != NULL && c != NULL) {
     lua_Number nb = nvalue(b), nc = nvalue(c);
     switch (op) {
       case TM_ADD: setnvalue(ra, luai_numadd(nb, nc)); break;
@@ -338,12 +557,30 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 }
 
 
+void luaV_objlen (lua_State *L, StkId ra, const TValue *rb) {
+  switch (ttype(rb)) {
+    case LUA_TTABLE: {
+      setinteger(ra, luaH_getn(hvalue(rb)));
+      break;
+    }
+    case LUA_TSTRING: {
+      setinteger(ra, cast(lua_Integer, tsvalue(rb)->len));
+      break;
+    }
+    default: {  /* try metamethod */
+      if (!call_binTM(L, rb, luaO_nilobject, ra, TM_LEN))
+        luaG_typeerror(L, rb, "get length of");
+    }
+  }
+}
+
+
 
 /*
 ** some macros for common tasks in `luaV_execute'
 */
 
-#define runtime_check(L, c)	{ if (!(c)) break; }
+#define runtime_check(L, c)	{ if (!(c)) vmbreak; }
 
 #define RA(i)	(base+GETARG_A(i))
 /* to be used after possible stack reallocation */
@@ -356,21 +593,230 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 #define KBx(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgK, k+GETARG_Bx(i))
 
 
+/* inline cache of the current instruction (see `luaH_getstrc') */
+#define ICACHE(pc)	(cl->p->cache + pcRel(pc, cl->p))
+
+
 #define dojump(L,pc,i)	{(pc) += (i); luai_threadyield(L);}
 
 
-#define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
+#define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; updatedisp(); }
+
+
+/* line and count hooks on? */
+#define hooked(L)	((L)->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))
+
+
+/*
+** run the line/count hooks before the instruction in `i'. A hook may
+** yield, and then the instruction is re-executed when the coroutine
+** resumes.
+*/
+#define vmhook() \
+  if (hooked(L) && (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) { \
+    traceexec(L, pc); \
+    if (L->status == LUA_YIELD) {  /* did hook yield? */ \
+      L->savedpc = pc - 1; \
+      return; \
+    } \
+    base = L->base; \
+  }
+
+
+/*
+** instruction dispatch. With LUA_USE_JUMPTABLE every opcode ends with
+** its own indirect jump to the next one (see ljumptab.h), which gives
+** the branch predictor one history per opcode instead of a single
+** shared `switch' jump; otherwise fall back to the ANSI `switch'.
+**
+** The jump table build has two dispatch tables and so two variants of
+** the loop: without hooks, `disp' is `disptab' and no instruction tests
+** the hook mask; with line or count hooks, `disp' is `hooktab', which
+** sends every instruction to `L_hook' first. `disp' follows the hook
+** mask (see `lua_sethook') wherever the mask may have changed: at entry,
+** after anything that may run other code (`Protect' and calls) and at
+** backward jumps, where a signal handler may have set a hook.
+**
+** `vmfuse' ends the first word of a fused pair (see `luaK_fuse'): it
+** fetches the second word and goes directly to its handler, which is
+** marked with `vmlabel'; with hooks on it goes through `L_hook' first.
+*/
+#if defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__) && !defined(__clang__)
+/* otherwise GCC merges all dispatch jumps back into a single one */
+#pragma GCC optimize ("no-crossjumping")
+#endif
+#define vmfetch()	{ i = *pc++; vmcheck(); }
+#define vmdispatch(o)	goto *disp[o];
+#define vmcase(l)	L_##l:
+#define vmbreak		{ vmfetch(); vmdispatch(GET_OPCODE(i)); }
+#define updatedisp()	(disp = hooked(L) ? hooktab : disptab)
+#define vmlabel(l)	/* `vmcase' already made it */
+#define vmfuse(l)	{ vmfetch(); \
+  if (disp != disptab) goto L_hook; else goto L_##l; }
+#else
+#define vmfetch()	{ i = *pc++; vmhook(); vmcheck(); }
+#define vmdispatch(o)	switch (o)
+#define vmcase(l)	case l:
+#define vmbreak		continue
+#define updatedisp()	((void)0)
+#define vmlabel(l)	L_##l:
+#define vmfuse(l)	{ vmfetch(); goto L_##l; }
+#endif
+
+
+/*
+** set `ra' for the instruction in `i'
+** warning!! several calls may realloc the stack and invalidate `ra'
+*/
+#define vmcheck()	{ \
+  ra = RA(i); \
+  lua_assert(base == L->base && L->base == L->ci->base); \
+  lua_assert(base <= L->top && L->top <= L->stack + L->stacksize); \
+  lua_assert(L->top == L->ci->top || luaG_checkopenop(i)); \
+}
+
+
+/* R(A) := rb op rc, for numbers `rb' and `rc' */
+#define numarith(op,iop,rb,rc) \
+        if (ttisint(rb) && ttisint(rc)) \
+          iop(ra, ivalue(rb), ivalue(rc)); \
+        else { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        }
 
 
-#define arith_op(op,tm) { \
+#define arith_op(op,iop,tm) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
         if (ttisnumber(rb) && ttisnumber(rc)) { \
-          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
-          setnvalue(ra, op(nb, nc)); \
+          numarith(op, iop, rb, rc); \
         } \
         else \
-          Protect(Arith(L, ra, rb, rc, tm)); \
+          Protect(luaV_arith(L, ra, rb, rc, tm)); \
+      }
+
+
+/*
+** Quickening: a generic arithmetic or order instruction that finds
+** numbers in its operands rewrites itself in place into a specialized
+** form (see the end of OpCode), which only checks the operand tags. When
+** such a guard fails the instruction goes back to its generic form; its
+** inline-cache slot counts these failures, and after MAXDESPEC of them
+** the instruction stays generic.
+*/
+#define MAXDESPEC	3
+
+#define setop(pc,o)	SET_OPCODE(*cast(Instruction *, (pc)-1), o)
+
+#define quicken(pc,o)	{ if (*ICACHE(pc) < MAXDESPEC) setop(pc, o); }
+
+#define despecialize(pc,o)	{ (*ICACHE(pc))++; setop(pc, o); }
+
+/* Kst(C) of an instruction quickened with a numeric constant operand */
+#define KC(i)	check_exp(ISK(GETARG_C(i)) && \
+	ttisnumber(k+INDEXK(GETARG_C(i))), k+INDEXK(GETARG_C(i)))
+
+
+#define arith_qop(op,iop,tm,qop) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        if (ttisnumber(rb) && ttisnumber(rc)) { \
+          numarith(op, iop, rb, rc); \
+          quicken(pc, qop); \
+        } \
+        else \
+          Protect(luaV_arith(L, ra, rb, rc, tm)); \
+      }
+
+
+#define arith_nn(op,iop,tm,gop) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        if (ttisnumber(rb) && ttisnumber(rc)) { \
+          numarith(op, iop, rb, rc); \
+        } \
+        else { \
+          despecialize(pc, gop); \
+          Protect(luaV_arith(L, ra, rb, rc, tm)); \
+        } \
+      }
+
+
+#define arith_nk(op,iop,tm,gop) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = KC(i); \
+        if (ttisnumber(rb)) { \
+          numarith(op, iop, rb, rc); \
+        } \
+        else { \
+          despecialize(pc, gop); \
+          Protect(luaV_arith(L, ra, rb, rc, tm)); \
+        } \
+      }
+
+
+/* specialized form of OP_ADD/OP_SUB/OP_MUL for the operands of `i' */
+#define qform(i,nn,nk)	(ISK(GETARG_C(i)) ? (nk) : (nn))
+
+
+/*
+** a call that `OP_CALL' can set up by itself, without `luaD_precall':
+** a Lua function with fixed parameters, no call hook, a free CallInfo
+** and enough stack (otherwise `luaD_precall' grows them)
+*/
+#define fastcall(L,func) \
+	(ttisfunction(func) && !clvalue(func)->c.isC && \
+	 !clvalue(func)->l.p->is_vararg && !((L)->hookmask & LUA_MASKCALL) && \
+	 (L)->ci != (L)->end_ci && \
+	 (L)->stack_last - (L)->top > clvalue(func)->l.p->maxstacksize)
+
+
+/* form of OP_FORLOOP for the loop values at `ra' (see `luaV_forprep') */
+#define forloopform(ra) \
+	(!ttisint(ra) ? OP_FORLOOP : \
+	 (ivalue((ra)+2) > 0) ? OP_FORLOOPUP : OP_FORLOOPDOWN)
+
+
+/* numeric `for' goes round once more: jump back to the loop body */
+#if defined(LUA_USE_JIT)
+#define forjump(i)	{ \
+          int *slot = ICACHE(pc);  /* hotness counter or trace */ \
+          dojump(L, pc, GETARG_sBx(i)); \
+          updatedisp(); \
+          if (G(L)->jit != NULL && !hooked(L)) \
+            Protect(pc = luaJ_loop(L, cl, pc, slot)); \
+        }
+#else
+#define forjump(i)	{ dojump(L, pc, GETARG_sBx(i)); updatedisp(); }
+#endif
+
+
+/* R(A) := R(B)[RK(C)], then `cont' */
+#define gettable_op(cont) { \
+        TValue *rb = RB(i); \
+        TValue *rc = RKC(i); \
+        if (ttistable(rb) && ttisstring(rc)) {  /* field access? */ \
+          Table *h = hvalue(rb); \
+          int *c = ICACHE(pc); \
+          const TValue *res = luaH_getstrc(h, rawtsvalue(rc), c); \
+          if (!ttisnil(res) || fasttm(L, h->metatable, TM_INDEX) == NULL) { \
+            setobj2s(L, ra, res); \
+            cont; \
+          } \
+        } \
+        else if (ttistable(rb) && ttisint(rc)) {  /* array access? */ \
+          Table *h = hvalue(rb); \
+          size_t n = cast(size_t, ivalue(rc) - 1); \
+          if (n < cast(size_t, h->sizearray) && (!arrisnil(h, n) || \
+              fasttm(L, h->metatable, TM_INDEX) == NULL)) { \
+            getarray(L, h, n, ra); \
+            cont; \
+          } \
+        } \
+        Protect(luaV_gettable(L, rb, rc, ra)); \
+        cont; \
       }
 
 
@@ -380,31 +826,40 @@ void luaV_execute (lua_State *L, int nexeccalls) {
   StkId base;
   TValue *k;
   const Instruction *pc;
+  Instruction i;
+  StkId ra;
+#if defined(LUA_USE_JUMPTABLE)
+#include "ljumptab.h"
+#endif
  reentry:  /* entry point */
   lua_assert(isLua(L->ci));
   pc = L->savedpc;
   cl = &clvalue(L->ci->func)->l;
   base = L->base;
   k = cl->p->k;
+  updatedisp();
+  if (!hooked(L)) {
+    /* run compiled code up to a call */
+    Proto *p = cl->p;
+    if (p->native != NULL)
+      Protect(pc = p->code + (*p->native)(L, cast_int(pc - p->code)))
+#if defined(LUA_USE_JIT)
+    else if (G(L)->jit != NULL)
+      Protect(pc = luaJ_call(L, cl, pc))
+#endif
+  }
   /* main loop of interpreter */
   for (;;) {
-    const Instruction i = *pc++;
-    StkId ra;
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      traceexec(L, pc);
-      if (L->status == LUA_YIELD) {  /* did hook yield? */
-        L->savedpc = pc - 1;
-        return;
+    vmfetch();
+    vmdispatch (GET_OPCODE(i)) {
+#if defined(LUA_USE_JUMPTABLE)
+      L_hook: {  /* each instruction, in the `hooktab' variant */
+        vmhook();
+        vmcheck();
+        updatedisp();
+        goto *disptab[GET_OPCODE(i)];
       }
-      base = L->base;
-    }
-    /* warning!! several calls may realloc the stack and invalidate `ra' */
-    ra = RA(i);
-    lua_assert(base == L->base && L->base == L->ci->base);
-    lua_assert(base <= L->top && L->top <= L->stack + L->stacksize);
-    lua_assert(L->top == L->ci->top || luaG_checkopenop(i));
-    switch (GET_OPCODE(i)) {
+#endif
       /* 
       ** Instruction Notation
       ** R(A) Register A (specified in instruction field A)
@@ -428,9 +883,9 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** closures, always appearing after the CLOSURE instruction; see CLOSURE
       ** for more information.
       */
-      case OP_MOVE: {
+      vmcase(OP_MOVE) {
         setobjs2s(L, ra, RB(i));
-        continue;
+        vmbreak;
       }
 
       /*
@@ -438,9 +893,9 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** Loads constant number Bx into register R(A). Constants are usually
       ** numbers or strings. Each function has its own constant list, or pool.
       */
-      case OP_LOADK: {
+      vmcase(OP_LOADK) {
         setobj2s(L, ra, KBx(i));
-        continue;
+        vmbreak;
       }
       
       /*
@@ -452,10 +907,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** You can use any non-zero value for the boolean true in field B, but since
       ** you cannot use booleans as numbers in Lua, it’s best to stick to 1 for true. 
       */
-      case OP_LOADBOOL: {
+      vmcase(OP_LOADBOOL) {
         setbvalue(ra, GETARG_B(i));
         if (GETARG_C(i)) pc++;  /* skip next instruction (if C) */
-        continue;
+        vmbreak;
       }
 
       /*
@@ -464,12 +919,12 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** be assigned to, then R(A) = R(B). When two or more consecutive locals
       ** need to be assigned nil values, only a single LOADNIL is needed.
       */
-      case OP_LOADNIL: {
+      vmcase(OP_LOADNIL) {
         TValue *rb = RB(i);
         do {
           setnilvalue(rb--);
         } while (rb >= ra);
-        continue;
+        vmbreak;
       }
 
       /*
@@ -481,10 +936,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** creating closures, always appearing after the CLOSURE instruction; see
       ** CLOSURE for more information.
       */
-      case OP_GETUPVAL: {
+      vmcase(OP_GETUPVAL) {
         int b = GETARG_B(i);
         setobj2s(L, ra, cl->upvals[b]->v);
-        continue;
+        vmbreak;
       }
 
       /*
@@ -492,13 +947,21 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** Copies the value of the global variable whose name is given in constant
       ** number Bx into register R(A). The name constant must be a string.
       */
-      case OP_GETGLOBAL: {
-        TValue g;
+      vmcase(OP_GETGLOBAL) {
+        Table *h = cl->env;
         TValue *rb = KBx(i);
-        sethvalue(L, &g, cl->env);
+        const TValue *res;
         lua_assert(ttisstring(rb));
-        Protect(luaV_gettable(L, &g, rb, ra));
-        continue;
+        res = luaH_getstrc(h, rawtsvalue(rb), ICACHE(pc));
+        if (!ttisnil(res) || fasttm(L, h->metatable, TM_INDEX) == NULL) {
+          setobj2s(L, ra, res);
+        }
+        else {  /* absent global in an environment with `__index' */
+          TValue g;
+          sethvalue(L, &g, h);
+          Protect(luaV_gettable(L, &g, rb, ra));
+        }
+        vmbreak;
       }
 
       /*
@@ -507,9 +970,8 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** referenced by register R(B), while the index to the table is given by RK(C),
       ** which may be the value of register R(C) or a constant number.
       */
-      case OP_GETTABLE: {
-        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
-        continue;
+      vmcase(OP_GETTABLE) vmlabel(OP_GETTABLE) {
+        gettable_op(vmbreak);
       }
 
       /*
@@ -517,12 +979,26 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** Copies the value from register R(A) into the global variable whose name is
       ** given in constant number Bx. The name constant must be a string.
       */
-      case OP_SETGLOBAL: {
-        TValue g;
-        sethvalue(L, &g, cl->env);
-        lua_assert(ttisstring(KBx(i)));
-        Protect(luaV_settable(L, &g, KBx(i), ra));
-        continue;
+      vmcase(OP_SETGLOBAL) {
+        Table *h = cl->env;
+        TValue *rb = KBx(i);
+        TValue *slot;
+        lua_assert(ttisstring(rb));
+        slot = cast(TValue *, luaH_getstrc(h, rawtsvalue(rb), ICACHE(pc)));
+        if (slot != luaO_nilobject &&  /* global already present? */
+            (!ttisnil(slot) ||
+             fasttm(L, h->metatable, TM_NEWINDEX) == NULL)) {
+          luaT_mcwrite(L, h);
+          setobj2t(L, slot, ra);
+          h->flags = 0;
+          luaC_barriert(L, h, ra);
+        }
+        else {
+          TValue g;
+          sethvalue(L, &g, h);
+          Protect(luaV_settable(L, &g, rb, ra));
+        }
+        vmbreak;
       }
 
       /*
@@ -530,11 +1006,11 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** Copies the value from register R(A) into the upvalue number B in the
       ** upvalue list for that function.
       */
-      case OP_SETUPVAL: {
+      vmcase(OP_SETUPVAL) {
         UpVal *uv = cl->upvals[GETARG_B(i)];
         setobj(L, uv->v, ra);
         luaC_barrier(L, uv, ra);
-        continue;
+        vmbreak;
       }
 
       /*
@@ -543,9 +1019,34 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** table is referenced by register R(A), while the index to the table is given by
       ** RK(B), which may be the value of register R(B) or a constant number.
       */
-      case OP_SETTABLE: {
-        Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
-        continue;
+      vmcase(OP_SETTABLE) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttistable(ra) && ttisstring(rb)) {  /* field store? */
+          Table *h = hvalue(ra);
+          int *c = ICACHE(pc);
+          TValue *slot = cast(TValue *, luaH_getstrc(h, rawtsvalue(rb), c));
+          if (slot != luaO_nilobject &&  /* key already present? */
+              (!ttisnil(slot) ||
+               fasttm(L, h->metatable, TM_NEWINDEX) == NULL)) {
+            luaT_mcwrite(L, h);
+            setobj2t(L, slot, rc);
+            h->flags = 0;
+            luaC_barriert(L, h, rc);
+            vmbreak;
+          }
+        }
+        else if (ttistable(ra) && ttisint(rb)) {  /* array store? */
+          Table *h = hvalue(ra);
+          size_t n = cast(size_t, ivalue(rb) - 1);
+          if (n < cast(size_t, h->sizearray) && (!arrisnil(h, n) ||
+              fasttm(L, h->metatable, TM_NEWINDEX) == NULL)) {
+            setarray(L, h, n, rc);
+            vmbreak;
+          }
+        }
+        Protect(luaV_settable(L, ra, rb, rc));
+        vmbreak;
       }
 
       /*
@@ -564,12 +1065,12 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** elements and the number of hash elements. Then, each size value is
       ** rounded up and encoded in B and C using the floating point byte format.
       */
-      case OP_NEWTABLE: {
+      vmcase(OP_NEWTABLE) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
         sethvalue(L, ra, luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
 
       /*
@@ -582,11 +1083,34 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** method function itself is found using the table index RK(C), which may be
       ** the value of register R(C) or a constant number.
       */
-      case OP_SELF: {
+      vmcase(OP_SELF) {
         StkId rb = RB(i);
+        TValue *rc = RKC(i);
         setobjs2s(L, ra+1, rb);
-        Protect(luaV_gettable(L, rb, RKC(i), ra));
-        continue;
+        if (ttisstring(rc)) {  /* try the inline and method caches */
+          TString *key = rawtsvalue(rc);
+          const TValue *res = NULL;
+          Table *mt;
+          if (ttistable(rb)) {
+            Table *h = hvalue(rb);
+            int *c = ICACHE(pc);
+            res = luaH_getstrc(h, key, c);
+            mt = h->metatable;
+            if (ttisnil(res) && mt != NULL)
+              res = luaV_getmethod(L, mt, key);
+          }
+          else {
+            mt = ttisuserdata(rb) ? uvalue(rb)->metatable : G(L)->mt[ttype(rb)];
+            if (mt != NULL)
+              res = luaV_getmethod(L, mt, key);
+          }
+          if (res != NULL) {
+            setobj2s(L, ra, res);
+            vmbreak;
+          }
+        }
+        Protect(luaV_gettable(L, rb, rc, ra));
+        vmbreak;
       }
 
       /*
@@ -603,29 +1127,29 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** ADD is addition. SUB is subtraction. MUL is multiplication. DIV is division.
       ** MOD is modulus (remainder). POW is exponentiation.
       */
-      case OP_ADD: {
-        arith_op(luai_numadd, TM_ADD);
-        continue;
+      vmcase(OP_ADD) {
+        arith_qop(luai_numadd, intadd, TM_ADD, qform(i, OP_ADDNN, OP_ADDNK));
+        vmbreak;
       }
-      case OP_SUB: {
-        arith_op(luai_numsub, TM_SUB);
-        continue;
+      vmcase(OP_SUB) {
+        arith_qop(luai_numsub, intsub, TM_SUB, qform(i, OP_SUBNN, OP_SUBNK));
+        vmbreak;
       }
-      case OP_MUL: {
-        arith_op(luai_nummul, TM_MUL);
-        continue;
+      vmcase(OP_MUL) {
+        arith_qop(luai_nummul, intmul, TM_MUL, qform(i, OP_MULNN, OP_MULNK));
+        vmbreak;
       }
-      case OP_DIV: {
-        arith_op(luai_numdiv, TM_DIV);
-        continue;
+      vmcase(OP_DIV) {
+        arith_qop(luai_numdiv, intdiv, TM_DIV, OP_DIVNN);
+        vmbreak;
       }
-      case OP_MOD: {
-        arith_op(luai_nummod, TM_MOD);
-        continue;
+      vmcase(OP_MOD) {
+        arith_op(luai_nummod, intmod, TM_MOD);
+        vmbreak;
       }
-      case OP_POW: {
-        arith_op(luai_numpow, TM_POW);
-        continue;
+      vmcase(OP_POW) {
+        arith_op(luai_numpow, intpow, TM_POW);
+        vmbreak;
       }
 
       /*
@@ -633,16 +1157,19 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** Unary minus (arithmetic operator with one input.) R(B) is negated and the
       ** value placed in R(A). R(A) and R(B) are always registers.
       */
-      case OP_UNM: {
+      vmcase(OP_UNM) {
         TValue *rb = RB(i);
-        if (ttisnumber(rb)) {
+        if (ttisint(rb)) {
+          intunm(ra, ivalue(rb));
+        }
+        else if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
         }
         else {
-          Protect(Arith(L, ra, rb, rb, TM_UNM));
+          Protect(luaV_arith(L, ra, rb, rb, TM_UNM));
         }
-        continue;
+        vmbreak;
       }
 
       /*
@@ -650,10 +1177,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** Applies a boolean NOT to the value in R(B) and places the result in R(A).
       ** R(A) and R(B) are always registers.
       */
-      case OP_NOT: {
+      vmcase(OP_NOT) {
         int res = l_isfalse(RB(i));  /* next assignment may change this value */
         setbvalue(ra, res);
-        continue;
+        vmbreak;
       }
 
       /*
@@ -663,25 +1190,22 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** other objects, the metamethod is called. The result, which is a number, is
       ** placed in R(A).
       */
-      case OP_LEN: {
+      vmcase(OP_LEN) {
         const TValue *rb = RB(i);
         switch (ttype(rb)) {
           case LUA_TTABLE: {
-            setnvalue(ra, cast_num(luaH_getn(hvalue(rb))));
+            setinteger(ra, luaH_getn(hvalue(rb)));
             break;
           }
           case LUA_TSTRING: {
-            setnvalue(ra, cast_num(tsvalue(rb)->len));
+            setinteger(ra, cast(lua_Integer, tsvalue(rb)->len));
             break;
           }
           default: {  /* try metamethod */
-            Protect(
-              if (!call_binTM(L, rb, luaO_nilobject, ra, TM_LEN))
-                luaG_typeerror(L, rb, "get length of");
-            )
+            Protect(luaV_objlen(L, ra, rb));
           }
         }
-        continue;
+        vmbreak;
       }
 
       /*
@@ -691,12 +1215,12 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** more expressions. The source registers must be consecutive, and C must
       ** always be greater than B. The result is placed in R(A).
       */
-      case OP_CONCAT: {
+      vmcase(OP_CONCAT) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
         Protect(luaV_concat(L, c-b+1, c); luaC_checkGC(L));
         setobjs2s(L, RA(i), base+b);
-        continue;
+        vmbreak;
       }
 
       /*
@@ -707,9 +1231,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** JMP is used in loops, conditional statements, and in expressions when a
       ** boolean true/false need to be generated.
       */
-      case OP_JMP: {
+      vmcase(OP_JMP) {
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        updatedisp();
+        vmbreak;
       }
 
       /*
@@ -727,7 +1252,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** execution in the virtual machine. In effect, EQ, LT and LE must always be
       ** paired with a following JMP instruction.
       */
-      case OP_EQ: {
+      vmcase(OP_EQ) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         Protect(
@@ -735,23 +1260,37 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_LT: {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
+      vmcase(OP_LT) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisnumber(rb) && ttisnumber(rc)) {
+          quicken(pc, OP_LTNN);
+          if (numlt(rb, rc) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (luaV_lessthan(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_LE: {
-        Protect(
-          if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
+      vmcase(OP_LE) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisnumber(rb) && ttisnumber(rc)) {
+          quicken(pc, OP_LENN);
+          if (numle(rb, rc) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (luaV_lessequal(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        vmbreak;
       }
 
       /*
@@ -771,20 +1310,20 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** execution in the virtual machine. In effect, TEST and TESTSET must
       ** always be paired with a following JMP instruction.
       */
-      case OP_TEST: {
+      vmcase(OP_TEST) {
         if (l_isfalse(ra) != GETARG_C(i))
           dojump(L, pc, GETARG_sBx(*pc));
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_TESTSET: {
+      vmcase(OP_TESTSET) {
         TValue *rb = RB(i);
         if (l_isfalse(rb) != GETARG_C(i)) {
           setobjs2s(L, ra, rb);
           dojump(L, pc, GETARG_sBx(*pc));
         }
         pc++;
-        continue;
+        vmbreak;
       }
 
       /*
@@ -803,11 +1342,32 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** CALL always updates the top of stack value. CALL, RETURN, VARARG
       ** and SETLIST can use multiple values (up to the top of the stack.)
       */
-      case OP_CALL: {
+      vmcase(OP_CALL) vmlabel(OP_CALL) {
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
+        if (fastcall(L, ra)) {  /* Lua function with fixed parameters? */
+          Proto *np = clvalue(ra)->l.p;
+          CallInfo *ci;
+          StkId st;
+          L->ci->savedpc = pc;
+          base = ra + 1;
+          if (L->top > base + np->numparams)
+            L->top = base + np->numparams;  /* drop extra arguments */
+          ci = ++L->ci;
+          ci->func = ra;
+          L->base = ci->base = base;
+          ci->top = base + np->maxstacksize;
+          ci->tailcalls = 0;
+          ci->nresults = nresults;
+          for (st = L->top; st < ci->top; st++)
+            setnilvalue(st);
+          L->top = ci->top;
+          L->savedpc = np->code;
+          nexeccalls++;
+          goto reentry;
+        }
         switch (luaD_precall(L, ra, nresults)) {
           case PCRLUA: {
             nexeccalls++;
@@ -817,7 +1377,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             /* it was a C function (`precall' called it); adjust results */
             if (nresults >= 0) L->top = L->ci->top;
             base = L->base;
-            continue;
+            updatedisp();
+            if (cl->p->jitcode != NULL || cl->p->native != NULL)
+              goto reentry;  /* back to compiled code */
+            vmbreak;
           }
           default: {
             return;  /* yield */
@@ -837,7 +1400,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** C isn’t used by TAILCALL, since all return results are significant. In any
       ** case, Lua always generates a 0 for C, to denote multiple return results.
       */
-      case OP_TAILCALL: {
+      vmcase(OP_TAILCALL) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
@@ -862,7 +1425,8 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           }
           case PCRC: {  /* it was a C function (`precall' called it) */
             base = L->base;
-            continue;
+            updatedisp();
+            vmbreak;
           }
           default: {
             return;  /* yield */
@@ -881,11 +1445,27 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** RETURN also closes any open upvalues, equivalent to a CLOSE
       ** instruction. See the CLOSE instruction for more information.
       */
-      case OP_RETURN: {
+      vmcase(OP_RETURN) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b-1;
         if (L->openupval) luaF_close(L, base);
         L->savedpc = pc;
+        if (nexeccalls > 1 && !(L->hookmask & LUA_MASKRET)) {
+          /* back to a Lua caller in this same loop: `luaD_poscall' inline */
+          CallInfo *ci = L->ci--;
+          StkId res = ci->func;
+          int wanted = ci->nresults;
+          nexeccalls--;
+          L->base = (ci - 1)->base;
+          L->savedpc = (ci - 1)->savedpc;
+          for (b = wanted; b != 0 && ra < L->top; b--)
+            setobjs2s(L, res++, ra++);
+          while (b-- > 0)
+            setnilvalue(res++);
+          L->top = (wanted == LUA_MULTRET) ? res : L->ci->top;
+          lua_assert(isLua(L->ci));
+          goto reentry;
+        }
         b = luaD_poscall(L, ra);
         if (--nexeccalls == 0)  /* was previous function running `here'? */
           return;  /* no: return */
@@ -929,32 +1509,39 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** since loop variables are local to the loop itself, you should not be able to
       ** use it unless you cook up an implementation-specific hack.
       */
-      case OP_FORLOOP: {
-        lua_Number step = nvalue(ra+2);
-        lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
-        lua_Number limit = nvalue(ra+1);
-        if (luai_numlt(0, step) ? luai_numle(idx, limit)
-                                : luai_numle(limit, idx)) {
-          dojump(L, pc, GETARG_sBx(i));  /* jump back */
-          setnvalue(ra, idx);  /* update internal index... */
-          setnvalue(ra+3, idx);  /* ...and external index */
+      vmcase(OP_FORLOOP) vmlabel(OP_FORLOOP) {
+        int loop;
+        if (ttisint(ra)) {  /* integer loop? (see `luaV_forprep') */
+          lua_Integer step = ivalue(ra+2);
+          lua_Integer idx = ivalue(ra) + step;  /* increment index */
+          lua_Integer limit = ivalue(ra+1);
+          loop = (0 < step) ? (idx <= limit) : (limit <= idx);
+          if (loop) {
+            setivalue(ra, idx);  /* update internal index... */
+            setivalue(ra+3, idx);  /* ...and external index */
+          }
         }
-        continue;
+        else {
+          lua_Number step = nvalue(ra+2);
+          lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
+          lua_Number limit = nvalue(ra+1);
+          loop = luai_numlt(0, step) ? luai_numle(idx, limit)
+                                     : luai_numle(limit, idx);
+          if (loop) {
+            setnvalue(ra, idx);  /* update internal index... */
+            setnvalue(ra+3, idx);  /* ...and external index */
+          }
+        }
+        if (loop) forjump(i);
+        vmbreak;
       }
-      case OP_FORPREP: {
-        const TValue *init = ra;
-        const TValue *plimit = ra+1;
-        const TValue *pstep = ra+2;
+      vmcase(OP_FORPREP) {
         L->savedpc = pc;  /* next steps may throw errors */
-        if (!tonumber(init, ra))
-          luaG_runerror(L, LUA_QL("for") " initial value must be a number");
-        else if (!tonumber(plimit, ra+1))
-          luaG_runerror(L, LUA_QL("for") " limit must be a number");
-        else if (!tonumber(pstep, ra+2))
-          luaG_runerror(L, LUA_QL("for") " step must be a number");
-        setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
+        luaV_forprep(L, ra);
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        /* choose the form of the OP_FORLOOP at `pc' for this loop */
+        SET_OPCODE(*cast(Instruction *, pc), forloopform(ra));
+        vmbreak;
       }
 
       /*
@@ -989,21 +1576,23 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** the beginning of the loop. This is an optimization case; TFORLOOP will not
       ** work correctly without the JMP instruction.
       */
-      case OP_TFORLOOP: {
+      vmcase(OP_TFORLOOP) {
         StkId cb = ra + 3;  /* call base */
-        setobjs2s(L, cb+2, ra+2);
-        setobjs2s(L, cb+1, ra+1);
-        setobjs2s(L, cb, ra);
-        L->top = cb+3;  /* func. + 2 args (state and index) */
-        Protect(luaD_call(L, cb, GETARG_C(i)));
-        L->top = L->ci->top;
-        cb = RA(i) + 3;  /* previous call may change the stack */
+        if (!luaV_tforstep(L, ra, GETARG_C(i), ICACHE(pc))) {
+          setobjs2s(L, cb+2, ra+2);
+          setobjs2s(L, cb+1, ra+1);
+          setobjs2s(L, cb, ra);
+          L->top = cb+3;  /* func. + 2 args (state and index) */
+          Protect(luaD_call(L, cb, GETARG_C(i)));
+          L->top = L->ci->top;
+          cb = RA(i) + 3;  /* previous call may change the stack */
+        }
         if (!ttisnil(cb)) {  /* continue loop? */
           setobjs2s(L, cb-1, cb);  /* save control variable */
           dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
         }
         pc++;
-        continue;
+        vmbreak;
       }
 
       /*
@@ -1022,7 +1611,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** This happens only when operand C is unable to encode the block number,
       ** i.e. when C > 511, equivalent to an array index greater than 25550.
       */
-      case OP_SETLIST: {
+      vmcase(OP_SETLIST) {
         int n = GETARG_B(i);
         int c = GETARG_C(i);
         int last;
@@ -1039,10 +1628,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           luaH_resizearray(L, h, last);  /* pre-alloc it at once */
         for (; n > 0; n--) {
           TValue *val = ra+n;
-          setobj2t(L, luaH_setnum(L, h, last--), val);
-          luaC_barriert(L, h, val);
+          last--;  /* position `last' (from 0) is in the array part */
+          setarray(L, h, last, val);
         }
-        continue;
+        vmbreak;
       }
 
       /*
@@ -1056,9 +1645,9 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** all affected local variables for do end blocks or loop blocks. RETURN also
       ** does an implicit CLOSE when a function returns.
       */
-      case OP_CLOSE: {
+      vmcase(OP_CLOSE) {
         luaF_close(L, ra);
-        continue;
+        vmbreak;
       }
 
       /*
@@ -1077,7 +1666,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** GETUPVAL corresponds upvalue number B in the current lexical block.
       ** The VM uses these pseudo-instructions to manage upvalues.
       */
-      case OP_CLOSURE: {
+      vmcase(OP_CLOSURE) {
         Proto *p;
         Closure *ncl;
         int nup, j;
@@ -1095,7 +1684,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
         setclvalue(L, ra, ncl);
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
 
       /*
@@ -1107,7 +1696,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       ** fixed number of values is required, B is a value greater than 1. If any
       ** number of values is required, B is 0.
       */
-      case OP_VARARG: {
+      vmcase(OP_VARARG) vmlabel(OP_VARARG) {
         int b = GETARG_B(i) - 1;
         int j;
         CallInfo *ci = L->ci;
@@ -1126,7 +1715,182 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             setnilvalue(ra + j);
           }
         }
-        continue;
+        vmbreak;
+      }
+
+      /*
+      ** ADDNN, SUBNN, MULNN, DIVNN, ADDNK, SUBNK, MULNK, LTNN, LENN
+      ** Quickened forms of ADD, SUB, MUL, DIV, LT and LE, installed by the
+      ** generic instructions once they see numbers (NK: RK(C) is a numeric
+      ** constant). They only check the operand tags; when a check fails
+      ** the instruction reverts to its generic form and executes as such.
+      */
+      vmcase(OP_ADDNN) {
+        arith_nn(luai_numadd, intadd, TM_ADD, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBNN) {
+        arith_nn(luai_numsub, intsub, TM_SUB, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULNN) {
+        arith_nn(luai_nummul, intmul, TM_MUL, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_DIVNN) {
+        arith_nn(luai_numdiv, intdiv, TM_DIV, OP_DIV);
+        vmbreak;
+      }
+      vmcase(OP_ADDNK) {
+        arith_nk(luai_numadd, intadd, TM_ADD, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBNK) {
+        arith_nk(luai_numsub, intsub, TM_SUB, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULNK) {
+        arith_nk(luai_nummul, intmul, TM_MUL, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_LTNN) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisnumber(rb) && ttisnumber(rc)) {
+          if (numlt(rb, rc) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else {
+          despecialize(pc, OP_LT);
+          Protect(
+            if (luaV_lessthan(L, rb, rc) == GETARG_A(i))
+              dojump(L, pc, GETARG_sBx(*pc));
+          )
+        }
+        pc++;
+        vmbreak;
+      }
+      vmcase(OP_LENN) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisnumber(rb) && ttisnumber(rc)) {
+          if (numle(rb, rc) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else {
+          despecialize(pc, OP_LE);
+          Protect(
+            if (luaV_lessequal(L, rb, rc) == GETARG_A(i))
+              dojump(L, pc, GETARG_sBx(*pc));
+          )
+        }
+        pc++;
+        vmbreak;
+      }
+
+      /*
+      ** FORLOOPUP, FORLOOPDOWN
+      ** Forms of FORLOOP set by FORPREP for a loop over integers, one per
+      ** direction of the step. They check that the index is still an
+      ** integer (compiled code may have made the loop values numbers) and
+      ** that the step has their direction: `code' is shared, so another
+      ** activation of the same loop (recursion, another coroutine) may
+      ** have set the form for the opposite step.
+      */
+      vmcase(OP_FORLOOPUP) {
+        if (ttisint(ra) && ivalue(ra+2) > 0) {
+          lua_Integer idx = ivalue(ra) + ivalue(ra+2);
+          if (idx <= ivalue(ra+1)) {
+            setivalue(ra, idx);
+            setivalue(ra+3, idx);
+            forjump(i);
+          }
+          vmbreak;
+        }
+        setop(pc, OP_FORLOOP);
+        goto L_OP_FORLOOP;
+      }
+      vmcase(OP_FORLOOPDOWN) {
+        if (ttisint(ra) && ivalue(ra+2) <= 0) {
+          lua_Integer idx = ivalue(ra) + ivalue(ra+2);
+          if (ivalue(ra+1) <= idx) {
+            setivalue(ra, idx);
+            setivalue(ra+3, idx);
+            forjump(i);
+          }
+          vmbreak;
+        }
+        setop(pc, OP_FORLOOP);
+        goto L_OP_FORLOOP;
+      }
+
+      /*
+      ** Fused pairs (see `luaK_fuse'): the first instruction of the pair,
+      ** then straight into the handler of the second one.
+      */
+      vmcase(OP_MOVECALL) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_CALL);
+      }
+      vmcase(OP_GETTABLECALL) {
+        gettable_op(vmfuse(OP_CALL));
+      }
+      vmcase(OP_GETUPVALTABLE) {
+        int b = GETARG_B(i);
+        setobj2s(L, ra, cl->upvals[b]->v);
+        vmfuse(OP_GETTABLE);
+      }
+
+      /*
+      ** VARSELECT: `f(x, ...)' (see OP_VARARG and the note in lopcodes.h).
+      ** When `f' is `select', pick the selected varargs where they are,
+      ** without copying them all to the stack, and skip the CALL.
+      */
+      vmcase(OP_VARSELECT) {
+        StkId func = ra - 2;
+        TValue *sel = ra - 1;
+        CallInfo *ci = L->ci;
+        int n = cast_int(ci->base - ci->func) - cl->p->numparams - 1;
+        int first = -1;  /* first vararg selected */
+        lua_assert(GET_OPCODE(*pc) == OP_CALL &&
+                   GETARG_A(*pc) == GETARG_A(i) - 2);
+        if (L->hookmask == 0 && iscfunc(func, luaA_select)) {
+          if (ttisstring(sel) && *svalue(sel) == '#')
+            first = n;  /* no vararg, only their number */
+          else if (ttisnumber(sel)) {
+            lua_Integer k;
+            lua_Number nk = nvalue(sel);
+            lua_number2integer(k, nk);
+            if (k < 0) k += n + 1;
+            else if (k > n + 1) k = n + 1;
+            if (k >= 1) first = cast_int(k) - 1;
+          }
+        }
+        if (first < 0)  /* not `select' or an error: do the real call */
+          goto L_OP_VARARG;
+        else {
+          int wanted = GETARG_C(*pc) - 1;
+          int count = ttisstring(sel);  /* select('#', ...)? */
+          int nres = count ? 1 : n - first;
+          int j;
+          if (wanted == LUA_MULTRET) {
+            Protect(luaD_checkstack(L, nres));
+            func = RA(i) - 2;  /* previous call may change the stack */
+            wanted = nres;
+          }
+          if (count) {
+            setivalue(func, n);
+          }
+          else {
+            for (j = 0; j < nres && j < wanted; j++)
+              setobjs2s(L, func + j, ci->base - n + first + j);
+          }
+          for (j = nres; j < wanted; j++)
+            setnilvalue(func + j);
+          L->top = (GETARG_C(*pc) == 0) ? func + nres : ci->top;
+          pc++;  /* skip the CALL */
+          vmbreak;
+        }
       }
     }
   }
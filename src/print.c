@@ -16,6 +16,7 @@
 #include "lundump.h"
 
 #define PrintFunction	luaU_print
+#define PrintFusion	luaU_fusion
 
 #define Sizeof(x)	((int)sizeof(x))
 #define VOID(p)		((const void*)(p))
@@ -102,7 +103,7 @@ static void PrintCode(const Proto* f)
     if (o==OP_JMP) printf("%d",sbx); else printf("%d %d",a,sbx);
     break;
   }
-  switch (o)
+  switch (luaP_opbase[o])
   {
    case OP_LOADK:
     printf("\t; "); PrintConstant(f,bx);
@@ -226,3 +227,40 @@ void PrintFunction(const Proto* f, int full)
  for (i=0; i<n; i++) PrintFunction(f->p[i],full);
 }
 
+
+static void CountCode(const Proto* f, int* count)
+{
+ int pc,n=f->sizecode;
+ for (pc=0; pc<n; pc++)
+ {
+  Instruction i=f->code[pc];
+  OpCode o=GET_OPCODE(i);
+  count[o]++;
+  if (o==OP_SETLIST && GETARG_C(i)==0) pc++;	/* skip extra argument */
+ }
+ for (pc=0; pc<f->sizep; pc++) CountCode(f->p[pc],count);
+}
+
+void PrintFusion(const Proto* f)
+{
+ int count[NUM_OPCODES];
+ int o,n=0,fused=0;
+ for (o=0; o<NUM_OPCODES; o++) count[o]=0;
+ CountCode(f,count);
+ for (o=0; o<NUM_OPCODES; o++)
+ {
+  n+=count[o];
+  if (isfused(o)) fused+=count[o];
+ }
+ printf("%d instruction%s, %d in fused pairs (%.1f%% of dispatches saved)\n",
+	S(n),2*fused,(n>0) ? 100.0*fused/n : 0.0);
+ for (o=0; o<NUM_OPCODES; o++)
+ {
+  if (isfused(o))
+  {
+   int first=count[o]+count[luaP_opbase[o]];
+   printf("\t%-14s\t%d\t(%.1f%% of %s)\n",luaP_opnames[o],count[o],
+	(first>0) ? 100.0*count[o]/first : 0.0,luaP_opnames[luaP_opbase[o]]);
+  }
+ }
+}
@@ -0,0 +1,48 @@
+-- bench.lua
+-- time some of the other test programs, with their output thrown away
+-- usage: lua bench.lua [rounds]	(run it from this directory)
+
+local rounds=tonumber(arg and arg[1]) or 3
+
+local function noop() end
+
+-- each program runs in a fresh copy of the globals, so that it cannot
+-- disturb the next one and so that global access costs what it always does
+local function env(extra)
+  local e={}
+  for k,v in pairs(_G) do e[k]=v end
+  e._G=e
+  e.print=noop
+  e.io={write=noop, read=io.read, stdout=io.stdout, stderr=io.stderr}
+  for k,v in pairs(extra) do e[k]=v end
+  return e
+end
+
+-- name, globals to preset, times to run the program in each round
+local tests={
+  { "fib.lua",	{ arg={"32"} },	1 },
+  { "sieve.lua",	{ N=1000 },	50 },
+  { "life.lua",	{},		1 },
+  { "sort.lua",	{},		5000 },
+  { "hash.lua",	{ N=200000 },	1 },
+}
+
+local total=0
+print("program","best","(of "..rounds.." rounds)")
+for _,t in ipairs(tests) do
+  local f=assert(loadfile(t[1]))
+  local best
+  for r=1,rounds do
+    math.randomseed(42)
+    local c=os.clock()
+    for i=1,t[3] do
+      setfenv(f,env(t[2]))
+      f()
+    end
+    c=os.clock()-c
+    if best==nil or c<best then best=c end
+  end
+  total=total+best
+  print(t[1],string.format("%.3f",best))
+end
+print("total",string.format("%.3f",total))
@@ -0,0 +1,30 @@
+-- numeric for loops entered again with the opposite step while running
+-- (the VM specializes each loop for the direction of its step)
+
+-- recursion: the inner call runs the same loop downwards
+local function f(s,d)
+  local o={}
+  for i=1*s,3*s,s do
+    o[#o+1]=i
+    if d>0 and i==s then f(-s,d-1) end
+  end
+  return o
+end
+assert(#f(1,1)==3 and #f(-1,1)==3)
+
+-- coroutines: two activations of the same loop, interleaved
+local function count(a,b,s,o)
+  for i=a,b,s do
+    o[#o+1]=i
+    coroutine.yield()
+  end
+end
+local up,down={},{}
+local cu=coroutine.wrap(count)
+local cd=coroutine.wrap(count)
+cu(1,4,1,up)
+cd(4,1,-1,down)
+for n=1,4 do cu() cd() end
+assert(table.concat(up,",")=="1,2,3,4" and table.concat(down,",")=="4,3,2,1")
+
+print("ok")
@@ -0,0 +1,49 @@
+-- hash.lua
+-- string-heavy and integer-sparse workloads for the hash part of tables
+
+N=N or 20000
+
+-- string keys: build a table of words, look each up and miss some
+local function strings(n)
+  local words={}
+  for i=1,n do words[i]="word"..i end
+  local h={}
+  for i=1,n do h[words[i]]=i end
+  local s=0
+  for r=1,4 do
+    for i=1,n do s=s+h[words[i]] end
+  end
+  for i=1,n do
+    if h["none"..(i%97)]==nil then s=s+1 end
+  end
+  return s
+end
+
+-- sparse integer keys: too spread out for the array part
+local function integers(n)
+  local h={}
+  for i=1,n do h[i*7919]=i end
+  local s=0
+  for r=1,4 do
+    for i=1,n do s=s+h[i*7919] end
+  end
+  for i=1,n do
+    if h[i*7919+1]==nil then s=s+1 end
+  end
+  return s
+end
+
+-- many small tables with mixed keys, traversed and discarded
+local function small(n)
+  local s=0
+  for r=1,n/20 do
+    local h={}
+    for i=1,20 do h[i+0.5]=i h["k"..i]=i h[i*1000]=i end
+    for k,v in pairs(h) do s=s+v end
+  end
+  return s
+end
+
+print("strings",strings(N))
+print("integers",integers(N))
+print("small",small(N))